@@ -0,0 +1,169 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// code of a source file (bootstrap.ncvm by default) in the 32 bit form and in
+// the compact bytecode: size, cache lines, decoding speed, and the size and
+// load time (best of runs) of a mapped and a compact image of it
+//
+// usage: bench_bytecode [source] [runs]
+//
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../test/vm-fixture.h"
+
+#define DEFAULT_SOURCE  "bootstrap.ncvm"
+#define DEFAULT_RUNS    20
+#define DECODE_ROUNDS   200
+#define CACHE_LINE      64
+#define MAPPED_PATH     "/tmp/bench-bytecode-mapped.img"
+#define COMPACT_PATH    "/tmp/bench-bytecode-compact.img"
+
+static
+double
+nowSec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static
+VM*
+newBenchVM(Process** proc) {
+	VMParameters    params  = testParameters();
+	params.maxCFCount   = 64;
+	params.maxCISCount  = 65536;
+	return newVMWith(&params, proc);
+}
+
+// compiled from the source, a cached module would leave the words lazy
+static
+bool
+compile(Process* proc, const char* path) {
+	VM*         vm      = proc->vm;
+	Stream*     strm    = vmStreamOpenFile(vm, path, SM_RO);
+	if( strm == NULL ) {
+		return false;
+	}
+	vmStreamPush(vm, strm);
+	vmPushValue(proc, (Value){ .u32 = 0 });
+	vmReadEvalPrintLoop(proc);
+	vmStreamPop(vm);
+	return true;
+}
+
+static
+uint64_t
+fileSize(const char* path) {
+	struct stat st;
+	return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Return: the best time of a VM loading the image at path
+static
+double
+loadTime(const char* path, uint32_t runs) {
+	double      best    = 1e9;
+	for( uint32_t r = 0; r < runs; ++r ) {
+		Process*    proc;
+		VM*         vm      = newBenchVM(&proc);
+		double      start   = nowSec();
+		bool        isOk    = vmImageLoad(vm, path);
+		double      elapsed = nowSec() - start;
+		releaseVM(vm, proc);
+		best    = isOk && elapsed < best ? elapsed : best;
+	}
+	return best;
+}
+
+int
+main(int argc, char* argv[]) {
+	const char* source  = argc > 1 ? argv[1] : DEFAULT_SOURCE;
+	uint32_t    runs    = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : DEFAULT_RUNS;
+
+	Process*    proc;
+	VM*         vm      = newBenchVM(&proc);
+	if( !compile(proc, source) ) {
+		fprintf(stderr, "%s cannot be opened\n", source);
+		return 1;
+	}
+
+	uint32_t    count   = vm->insCount;
+	size_t      wide    = (size_t)count * sizeof(uint32_t);
+	size_t      size    = Bytecode_size(vm->ins, count);
+	uint8_t*    code    = malloc(size + 1);
+	uint32_t*   out     = malloc(wide + sizeof(uint32_t));
+	uint32_t    sizes[BYTECODE_MAX_SIZE + 1]    = { 0 };
+	for( uint32_t i = 0, pos = 0; i < count; ++i ) {
+		uint32_t    n   = Bytecode_encode(vm->ins[i], &code[pos]);
+		++sizes[n];
+		pos += n;
+	}
+
+	fprintf(stdout, "%s: %u functions, %u instructions\n", source, vm->funcCount, count);
+	fprintf(stdout, "  32 bit   %8zu bytes  %6zu cache lines\n", wide, (wide + CACHE_LINE - 1) / CACHE_LINE);
+	fprintf(stdout, "  compact  %8zu bytes  %6zu cache lines  (%.2f bytes/instruction, %.1f%%)\n", size,
+	        (size + CACHE_LINE - 1) / CACHE_LINE, (double)size / (count ? count : 1), 100.0 * (double)size / (double)(wide ? wide : 1));
+	fprintf(stdout, "  encoded sizes:");
+	for( uint32_t n = 1; n <= BYTECODE_MAX_SIZE; ++n ) {
+		fprintf(stdout, " %u:%u", n, sizes[n]);
+	}
+	fprintf(stdout, "\n");
+
+	// decoding against copying the 32 bit form
+	double      bestDecode  = 1e9;
+	double      bestCopy    = 1e9;
+	for( uint32_t r = 0; r < runs; ++r ) {
+		double      start   = nowSec();
+		for( uint32_t round = 0; round < DECODE_ROUNDS; ++round ) {
+			size_t      pos     = 0;
+			for( uint32_t i = 0; i < count; ++i ) {
+				Bytecode_decode(code, size, &pos, &out[i]);
+			}
+		}
+		double      elapsed = nowSec() - start;
+		bestDecode  = elapsed < bestDecode ? elapsed : bestDecode;
+
+		start   = nowSec();
+		for( uint32_t round = 0; round < DECODE_ROUNDS; ++round ) {
+			memcpy(out, vm->ins, wide);
+			__asm__ __volatile__("" : : "r"(out) : "memory");
+		}
+		elapsed     = nowSec() - start;
+		bestCopy    = elapsed < bestCopy ? elapsed : bestCopy;
+	}
+	if( memcmp(out, vm->ins, wide) != 0 ) {
+		fprintf(stderr, "the code does not decode to itself\n");
+		return 1;
+	}
+	double      perRound    = (double)DECODE_ROUNDS * (count ? count : 1);
+	fprintf(stdout, "  decode   %8.2f ns/instruction  (copy %.2f ns/instruction)\n", bestDecode * 1e9 / perRound, bestCopy * 1e9 / perRound);
+
+	bool        isOk    = vmImageSave(vm, MAPPED_PATH, false) && vmImageSave(vm, COMPACT_PATH, true);
+	releaseVM(vm, proc);
+	if( isOk ) {
+		fprintf(stdout, "  image    mapped  %8lu bytes  load %8.3f ms\n", (unsigned long)fileSize(MAPPED_PATH), loadTime(MAPPED_PATH, runs) * 1e3);
+		fprintf(stdout, "  image    compact %8lu bytes  load %8.3f ms\n", (unsigned long)fileSize(COMPACT_PATH), loadTime(COMPACT_PATH, runs) * 1e3);
+	}
+	unlink(MAPPED_PATH);
+	unlink(COMPACT_PATH);
+	free(code);
+	free(out);
+	return 0;
+}
@@ -0,0 +1,329 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// throughput and enqueue to dequeue latency of every queue in src/lock-free,
+// swept over producer/consumer counts, payload sizes and capacities. Payloads
+// are malloc'd and stamped by the producer, read and freed by the consumer
+// (like VM messages). One CSV row per run on stdout:
+//
+//   queue,producers,consumers,payload,capacity,items,ops_per_sec,p50_ns,p99_ns,p999_ns
+//
+// usage: bench_queues [items-per-producer]
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../src/lock-free/lock-free.h"
+
+#define DEFAULT_ITEMS       200000
+#define BATCH_COUNT         8
+#define MAX_THREADS         16
+
+////////////////////////////////////////////////////////////////////////////////
+// Latency histogram
+////////////////////////////////////////////////////////////////////////////////
+//
+// log-linear buckets: values below 16 are exact, above that each power of 2 is
+// split in 16 sub-buckets (~6% resolution)
+//
+
+#define HIST_SUB_BITS       4
+#define HIST_SUB_COUNT      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS        (64 * HIST_SUB_COUNT)
+
+typedef struct {
+    uint64_t    counts[HIST_BUCKETS];
+    uint64_t    total;
+} Histogram;
+
+static inline
+uint32_t
+bucketOf(uint64_t v) {
+    if( v < HIST_SUB_COUNT ) {
+        return (uint32_t)v;
+    }
+    uint32_t    msb     = 63 - (uint32_t)__builtin_clzll(v);
+    uint32_t    shift   = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (uint32_t)((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static inline
+uint64_t
+bucketValue(uint32_t b) {
+    uint32_t    major   = b / HIST_SUB_COUNT;
+    uint32_t    sub     = b % HIST_SUB_COUNT;
+    return major == 0 ? sub : (uint64_t)(HIST_SUB_COUNT + sub) << (major - 1);
+}
+
+static
+uint64_t
+percentile(const Histogram* h, double p) {
+    uint64_t    rank    = (uint64_t)((double)h->total * p);
+    uint64_t    seen    = 0;
+    for( uint32_t b = 0; b < HIST_BUCKETS; ++b ) {
+        seen    += h->counts[b];
+        if( seen > rank ) {
+            return bucketValue(b);
+        }
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queues
+////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    QK_BOUNDED,
+    QK_BOUNDED_BATCH,
+    QK_UNBOUNDED,
+    QK_SPSC,
+    QK_COUNT
+} QueueKind;
+
+static const char*  queueNames[QK_COUNT]    = { "bounded", "bounded.batch", "unbounded", "spsc" };
+
+typedef struct {
+    QueueKind       kind;
+    BoundedQueue    bq;
+    Queue           uq;
+    SpscQueue       sq;
+} AnyQueue;
+
+// Return: number of elements pushed
+static inline
+uint32_t
+pushSome(AnyQueue* q, void* const* data, uint32_t count) {
+    switch( q->kind ) {
+    case QK_BOUNDED:        return BoundedQueue_push(&q->bq, data[0]) ? 1 : 0;
+    case QK_BOUNDED_BATCH:  return BoundedQueue_pushN(&q->bq, data, count);
+    case QK_UNBOUNDED:      Queue_push(&q->uq, data[0]); return 1;
+    case QK_SPSC:           return SpscQueue_pushN(&q->sq, data, count);
+    default:                return 0;
+    }
+}
+
+// Return: number of elements popped
+static inline
+uint32_t
+popSome(AnyQueue* q, void** data, uint32_t count) {
+    switch( q->kind ) {
+    case QK_BOUNDED:        return (data[0] = BoundedQueue_pop(&q->bq)) != NULL ? 1 : 0;
+    case QK_BOUNDED_BATCH:  return BoundedQueue_popN(&q->bq, data, count);
+    case QK_UNBOUNDED:      return Queue_tryPop(&q->uq, &data[0]) ? 1 : 0;
+    case QK_SPSC:           return SpscQueue_popN(&q->sq, data, count);
+    default:                return 0;
+    }
+}
+
+// single element queues move one item at a time
+static inline
+uint32_t
+batchOf(QueueKind kind) {
+    return kind == QK_BOUNDED_BATCH || kind == QK_SPSC ? BATCH_COUNT : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    AnyQueue*   q;
+    size_t      count;
+    uint32_t    payload;
+    uint64_t    checksum;
+    uint64_t    touched;    // keeps the payload reads alive
+    Histogram   latency;
+} Job;
+
+static
+uint64_t
+nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static
+void*
+producer(void* arg) {
+    Job*        job     = arg;
+    uint32_t    batch   = batchOf(job->q->kind);
+    void*       items[BATCH_COUNT];
+
+    for( size_t i = 0; i < job->count; ) {
+        uint32_t    count   = job->count - i < batch ? (uint32_t)(job->count - i) : batch;
+        for( uint32_t j = 0; j < count; ++j ) {
+            uint64_t*   msg = malloc(job->payload);
+            memset(msg, (int)(i + j), job->payload);
+            msg[1]      = i + j;
+            job->checksum   += i + j;
+            msg[0]      = nowNs();
+            items[j]    = msg;
+        }
+
+        uint32_t    pushed  = 0;
+        while( pushed < count ) {
+            uint32_t    n   = pushSome(job->q, items + pushed, count - pushed);
+            if( n == 0 ) {
+                sched_yield();
+            }
+            pushed  += n;
+        }
+        i   += count;
+    }
+    return NULL;
+}
+
+static
+void*
+consumer(void* arg) {
+    Job*        job     = arg;
+    uint32_t    batch   = batchOf(job->q->kind);
+    void*       items[BATCH_COUNT];
+
+    for( size_t got = 0; got < job->count; ) {
+        uint32_t    want    = job->count - got < batch ? (uint32_t)(job->count - got) : batch;
+        uint32_t    n       = popSome(job->q, items, want);
+        if( n == 0 ) {
+            sched_yield();
+            continue;
+        }
+
+        uint64_t    now     = nowNs();
+        for( uint32_t j = 0; j < n; ++j ) {
+            uint64_t*   msg = items[j];
+            ++job->latency.counts[bucketOf(now - msg[0])];
+            ++job->latency.total;
+
+            // touch the whole payload
+            uint64_t    sum = 0;
+            for( uint32_t w = 2; w < job->payload / sizeof(uint64_t); ++w ) {
+                sum += msg[w];
+            }
+            job->checksum   += msg[1];
+            job->touched    += sum;
+            free(msg);
+        }
+        got += n;
+    }
+    return NULL;
+}
+
+static
+void
+run(QueueKind kind, uint32_t producers, uint32_t consumers, uint32_t payload, uint32_t cap, size_t items) {
+    static Job  jobs[MAX_THREADS];
+    pthread_t   threads[MAX_THREADS];
+    AnyQueue    q;
+    size_t      total   = (size_t)producers * items;
+
+    memset(&q, 0, sizeof(AnyQueue));
+    q.kind  = kind;
+    switch( kind ) {
+    case QK_BOUNDED:
+    case QK_BOUNDED_BATCH:  BoundedQueue_init(&q.bq, cap);  break;
+    case QK_UNBOUNDED:      Queue_init(&q.uq);              break;
+    case QK_SPSC:           SpscQueue_init(&q.sq, cap);     break;
+    default:                break;
+    }
+
+    memset(jobs, 0, sizeof(jobs));
+    uint64_t    start   = nowNs();
+    for( uint32_t c = 0; c < consumers; ++c ) {
+        jobs[c].q       = &q;
+        jobs[c].count   = total / consumers + (c < total % consumers ? 1 : 0);
+        jobs[c].payload = payload;
+        pthread_create(&threads[c], NULL, consumer, &jobs[c]);
+    }
+    for( uint32_t p = consumers; p < consumers + producers; ++p ) {
+        jobs[p].q       = &q;
+        jobs[p].count   = items;
+        jobs[p].payload = payload;
+        pthread_create(&threads[p], NULL, producer, &jobs[p]);
+    }
+
+    Histogram   latency;
+    uint64_t    in      = 0;
+    uint64_t    out     = 0;
+    memset(&latency, 0, sizeof(Histogram));
+    for( uint32_t t = 0; t < consumers + producers; ++t ) {
+        pthread_join(threads[t], NULL);
+        if( t < consumers ) {
+            out += jobs[t].checksum;
+            for( uint32_t b = 0; b < HIST_BUCKETS; ++b ) {
+                latency.counts[b]   += jobs[t].latency.counts[b];
+            }
+            latency.total   += jobs[t].latency.total;
+        } else {
+            in  += jobs[t].checksum;
+        }
+    }
+    uint64_t    elapsed = nowNs() - start;
+
+    switch( kind ) {
+    case QK_BOUNDED:
+    case QK_BOUNDED_BATCH:  BoundedQueue_release(&q.bq);    break;
+    case QK_UNBOUNDED:      Queue_release(&q.uq);           break;
+    case QK_SPSC:           SpscQueue_release(&q.sq);       break;
+    default:                break;
+    }
+
+    if( in != out ) {
+        fprintf(stderr, "%s %u/%u: checksum mismatch\n", queueNames[kind], producers, consumers);
+    }
+
+    fprintf(stdout, "%s,%u,%u,%u,%u,%zu,%.0f,%lu,%lu,%lu\n",
+            queueNames[kind], producers, consumers, payload, cap, total,
+            (double)total * 1e9 / (double)elapsed,
+            (unsigned long)percentile(&latency, 0.50),
+            (unsigned long)percentile(&latency, 0.99),
+            (unsigned long)percentile(&latency, 0.999));
+    fflush(stdout);
+}
+
+int
+main(int argc, char* argv[]) {
+    static const uint32_t   mixes[][2]  = { { 1, 1 }, { 2, 2 }, { 4, 4 }, { 4, 1 }, { 1, 4 } };
+    static const uint32_t   payloads[]  = { 16, 256, 4096 };
+    static const uint32_t   caps[]      = { 64, 1024 };
+
+    size_t  items   = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITEMS;
+
+    fprintf(stdout, "queue,producers,consumers,payload,capacity,items,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for( uint32_t kind = 0; kind < QK_COUNT; ++kind ) {
+        for( uint32_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m ) {
+            // the ring is only correct for one producer and one consumer
+            if( kind == QK_SPSC && (mixes[m][0] != 1 || mixes[m][1] != 1) ) {
+                continue;
+            }
+            for( uint32_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); ++p ) {
+                // the unbounded queue has no capacity, report it as 0
+                uint32_t    capCount    = kind == QK_UNBOUNDED ? 1 : sizeof(caps) / sizeof(caps[0]);
+                for( uint32_t c = 0; c < capCount; ++c ) {
+                    run(kind, mixes[m][0], mixes[m][1], payloads[p], kind == QK_UNBOUNDED ? 0 : caps[c], items);
+                }
+            }
+        }
+    }
+    return 0;
+}
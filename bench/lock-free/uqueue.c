@@ -0,0 +1,117 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// unbounded queue push/pop throughput for a few producer/consumer mixes
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include "../../src/lock-free/lock-free.h"
+
+#define ITEMS_PER_PRODUCER  1000000
+
+typedef struct {
+    Queue*      q;
+    size_t      count;
+    size_t      sum;
+} Job;
+
+static
+double
+nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static
+void*
+producer(void* arg) {
+    Job*    job = arg;
+    for( size_t i = 1; i <= job->count; ++i ) {
+        Queue_push(job->q, (void*)i);
+        job->sum    += i;
+    }
+    return NULL;
+}
+
+static
+void*
+consumer(void* arg) {
+    Job*    job = arg;
+    size_t  got = 0;
+    while( got < job->count ) {
+        void*   v   = Queue_pop(job->q);
+        if( v ) {
+            job->sum    += (size_t)v;
+            ++got;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static
+void
+run(uint32_t producers, uint32_t consumers) {
+    Queue       q;
+    pthread_t   threads[64];
+    Job         jobs[64]    = { 0 };
+    size_t      total       = (size_t)producers * ITEMS_PER_PRODUCER;
+
+    Queue_init(&q);
+
+    double  start   = nowSec();
+    for( uint32_t c = 0; c < consumers; ++c ) {
+        jobs[c]     = (Job){ .q = &q, .count = total / consumers + (c < total % consumers ? 1 : 0) };
+        pthread_create(&threads[c], NULL, consumer, &jobs[c]);
+    }
+    for( uint32_t p = 0; p < producers; ++p ) {
+        jobs[consumers + p]  = (Job){ .q = &q, .count = ITEMS_PER_PRODUCER };
+        pthread_create(&threads[consumers + p], NULL, producer, &jobs[consumers + p]);
+    }
+
+    size_t  in  = 0;
+    size_t  out = 0;
+    for( uint32_t t = 0; t < producers + consumers; ++t ) {
+        pthread_join(threads[t], NULL);
+        if( t < consumers ) {
+            out += jobs[t].sum;
+        } else {
+            in  += jobs[t].sum;
+        }
+    }
+    double  elapsed = nowSec() - start;
+
+    Queue_release(&q);
+    fprintf(stdout, "%2u producers %2u consumers: %8.2f Mops/s%s\n", producers, consumers,
+            (double)total / elapsed * 1e-6, in == out ? "" : "  SUM MISMATCH");
+}
+
+int
+main(int argc, char* argv[]) {
+    run(1, 1);
+    run(2, 2);
+    run(4, 4);
+    run(4, 1);
+    run(1, 4);
+    return 0;
+}
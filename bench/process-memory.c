@@ -0,0 +1,99 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// resident memory per idle process: spawn N processes with the stack sizes of
+// main.c, let each recurse depth calls deep and then sleep, compare the RSS
+// before and after
+//
+// usage: bench_process_memory [process-count [depth]]
+//
+
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include "../test/vm-fixture.h"
+
+#define DEFAULT_PROC_COUNT  100000
+
+static atomic_uint  idleCount;
+
+static
+void
+idle(Process* proc) {
+	atomic_fetch_add(&idleCount, 1);
+}
+
+static
+uint64_t
+residentBytes() {
+	unsigned long   size        = 0;
+	unsigned long   resident    = 0;
+	FILE*           f           = fopen("/proc/self/statm", "r");
+	if( f ) {
+		if( fscanf(f, "%lu %lu", &size, &resident) != 2 ) {
+			resident    = 0;
+		}
+		fclose(f);
+	}
+	return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+int
+main(int argc, char* argv[]) {
+	uint32_t        count   = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : DEFAULT_PROC_COUNT;
+	uint32_t        depth   = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 0;
+	char            src[256];
+	VMParameters    params  = {
+		.maxProcCount           = count + 1,
+		.maxFunctionCount       = 4096,
+		.maxInstructionCount    = 65536,
+		.maxCharSegmentSize     = 65536,
+		.maxFileCount           = 1024,
+		.maxCFCount             = 64,
+		.maxCISCount            = 65536,
+		.workerCount            = 4,
+	};
+
+	VM*         vm      = vmNew(&params);
+	Process*    root    = vmNewProcess(vm, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, 1024, 1024, 1024, 2 * 65536, 32769);
+
+	vmAddNativeFunction(vm, "bench.idle", false, idle, 0, 0);
+	snprintf(src, sizeof(src), ": dig vs.dup 0 u32.eq { } { 1 u32.sub dig 1 u32.add } cond ; : idler %u dig vs.drop bench.idle 1000000 sleep ;", depth);
+	eval(root, src);
+	uint32_t    idlerFn = vmFindFunction(vm, "idler") - 1;
+
+	uint64_t    before  = residentBytes();
+	for( uint32_t i = 0; i < count; ++i ) {
+		if( vmSpawn(vm, (ProcPtr){ .ptr = 0 }, idlerFn, 0, PP_NORMAL) == NULL ) {
+			fprintf(stderr, "spawn %u failed\n", i);
+			count   = i;
+			break;
+		}
+	}
+	while( atomic_load(&idleCount) < count ) {
+		sched_yield();
+	}
+	uint64_t    after   = residentBytes();
+
+	fprintf(stdout, "%u idle processes (depth %u): %.1f MB resident, %.1f KB per process\n", count, depth,
+	        (double)(after - before) / (1024.0 * 1024.0),
+	        (double)(after - before) / 1024.0 / (double)count);
+
+	releaseVM(vm, root);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// scheduling latency of probe processes while the workers are saturated with
+// low priority compute: a probe is spawned, the time until its first
+// instruction runs is recorded
+//
+
+#include <time.h>
+#include <sched.h>
+#include "../test/vm-fixture.h"
+
+#define WORKER_COUNT        4
+#define SPINNER_COUNT       (WORKER_COUNT * 8)
+#define SAMPLE_COUNT        2000
+
+static uint64_t     spawnTime;      // one probe in flight at a time
+static uint64_t     latencies[SAMPLE_COUNT];
+static atomic_uint  sampleCount;
+
+static
+uint64_t
+nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static
+void
+recordLatency(Process* proc) {
+	uint64_t    lat = nowNs() - spawnTime;
+	uint32_t    idx = atomic_fetch_add(&sampleCount, 1);
+	if( idx < SAMPLE_COUNT ) {
+		latencies[idx]  = lat;
+	}
+}
+
+static
+int
+compareU64(const void* a, const void* b) {
+	uint64_t    x   = *(const uint64_t*)a;
+	uint64_t    y   = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static
+void
+measure(VM* vm, uint32_t probeFn, ProcPriority prio, const char* name) {
+	atomic_store(&sampleCount, 0);
+	for( uint32_t s = 0; s < SAMPLE_COUNT; ++s ) {
+		uint32_t    expected    = s + 1;
+		spawnTime               = nowNs();
+		Process*    proc        = vmSpawn(vm, (ProcPtr){ .ptr = 0 }, probeFn, 0, prio);
+		assert(proc);
+		(void)proc;
+		while( atomic_load(&sampleCount) < expected ) {
+			sched_yield();
+		}
+	}
+
+	qsort(latencies, SAMPLE_COUNT, sizeof(uint64_t), compareU64);
+	fprintf(stdout, "%-8s probes: p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name,
+	        latencies[SAMPLE_COUNT / 2] / 1000.0,
+	        latencies[SAMPLE_COUNT * 99 / 100] / 1000.0,
+	        latencies[SAMPLE_COUNT - 1] / 1000.0);
+}
+
+int
+main(int argc, char* argv[]) {
+	VMParameters    params = {
+		.maxProcCount           = 16384,
+		.maxFunctionCount       = 4096,
+		.maxInstructionCount    = 65536,
+		.maxCharSegmentSize     = 65536,
+		.maxFileCount           = 1024,
+		.maxCFCount             = 64,
+		.maxCISCount            = 65536,
+		.workerCount            = WORKER_COUNT,
+	};
+
+	VM*         vm      = vmNew(&params);
+	Process*    root    = vmNewProcess(vm, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, 256, 256, 256, 1024, 64);
+
+	vmAddNativeFunction(vm, "bench.probe", false, recordLatency, 0, 0);
+	eval(root, ": spin spin ; : probe bench.probe ;");
+
+	uint32_t    spinFn  = vmFindFunction(vm, "spin") - 1;
+	uint32_t    probeFn = vmFindFunction(vm, "probe") - 1;
+
+	for( uint32_t i = 0; i < SPINNER_COUNT; ++i ) {
+		vmSpawn(vm, (ProcPtr){ .ptr = 0 }, spinFn, 0, PP_LOW);
+	}
+
+	fprintf(stdout, "%u workers saturated by %u low priority spinners\n", WORKER_COUNT, SPINNER_COUNT);
+	measure(vm, probeFn, PP_LOW,    "low");
+	measure(vm, probeFn, PP_NORMAL, "normal");
+	measure(vm, probeFn, PP_HIGH,   "high");
+
+	releaseVM(vm, root);
+	return 0;
+}
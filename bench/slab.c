@@ -0,0 +1,139 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// alloc/free throughput of the slab allocator against malloc, per thread
+// count. Every thread keeps a window of live blocks (16 to 1024 bytes) and
+// replaces one per iteration, a quarter of them is freed by the next thread.
+//
+// usage: bench_slab [iterations-per-thread]
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/slab.h"
+#include "../src/lock-free/lock-free.h"
+
+#define DEFAULT_ITERATIONS  2000000
+#define LIVE_COUNT          1024
+#define MAX_THREADS         8
+
+typedef struct {
+	void*   (*alloc)(size_t size);
+	void    (*free)(void* ptr);
+	const char* name;
+} Allocator;
+
+typedef struct {
+	const Allocator*    a;
+	BoundedQueue*       in;
+	BoundedQueue*       out;
+	size_t              iterations;
+} Job;
+
+static
+double
+nowSec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static
+void*
+worker(void* arg) {
+	Job*        job     = arg;
+	void*       live[LIVE_COUNT]    = { NULL };
+	uint32_t    seed    = (uint32_t)(uintptr_t)job;
+	void*       p;
+
+	for( size_t i = 0; i < job->iterations; ++i ) {
+		seed    = seed * 1103515245 + 12345;
+		uint32_t    slot    = (seed >> 8) % LIVE_COUNT;
+		if( live[slot] ) {
+			if( (seed & 3) == 0 && job->in != job->out && BoundedQueue_push(job->out, live[slot]) ) {
+				live[slot]  = NULL;
+			} else {
+				job->a->free(live[slot]);
+			}
+		}
+		live[slot]  = job->a->alloc(16 + (seed >> 16) % 1009);
+		*(uint32_t*)live[slot]  = seed;
+
+		if( (i & 63) == 0 ) {
+			while( (p = BoundedQueue_pop(job->in)) != NULL ) {
+				job->a->free(p);
+			}
+		}
+	}
+
+	for( uint32_t s = 0; s < LIVE_COUNT; ++s ) {
+		job->a->free(live[s]);
+	}
+	return NULL;
+}
+
+static
+void
+run(const Allocator* a, uint32_t threadCount, size_t iterations) {
+	pthread_t       threads[MAX_THREADS];
+	Job             jobs[MAX_THREADS];
+	BoundedQueue    queues[MAX_THREADS];
+
+	for( uint32_t t = 0; t < threadCount; ++t ) {
+		BoundedQueue_init(&queues[t], 4096);
+	}
+
+	double  start   = nowSec();
+	for( uint32_t t = 0; t < threadCount; ++t ) {
+		jobs[t] = (Job){ .a = a, .in = &queues[t], .out = &queues[(t + 1) % threadCount], .iterations = iterations };
+		pthread_create(&threads[t], NULL, worker, &jobs[t]);
+	}
+	for( uint32_t t = 0; t < threadCount; ++t ) {
+		pthread_join(threads[t], NULL);
+	}
+	double  elapsed = nowSec() - start;
+
+	for( uint32_t t = 0; t < threadCount; ++t ) {
+		void*   p;
+		while( (p = BoundedQueue_pop(&queues[t])) != NULL ) {
+			a->free(p);
+		}
+		BoundedQueue_release(&queues[t]);
+	}
+
+	fprintf(stdout, "%-6s %u threads: %8.2f Mops/s\n", a->name, threadCount,
+			(double)threadCount * (double)iterations / elapsed * 1e-6);
+}
+
+int
+main(int argc, char* argv[]) {
+	static const Allocator  allocators[]    = {
+		{ malloc,       free,       "malloc" },
+		{ Slab_alloc,   Slab_free,  "slab" },
+	};
+
+	size_t  iterations  = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+	for( uint32_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); ++a ) {
+		for( uint32_t t = 1; t <= MAX_THREADS; t *= 2 ) {
+			run(&allocators[a], t, iterations);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// time (best of runs) and resident memory (first run) of an empty VM, for the
+// caps of main.c and for caps 64 times larger
+//
+// usage: bench_vm_startup [runs]
+//
+
+#include <time.h>
+#include <unistd.h>
+#include "../src/internals.h"
+
+#define DEFAULT_RUNS    20
+
+static
+uint64_t
+residentBytes() {
+	unsigned long   size        = 0;
+	unsigned long   resident    = 0;
+	FILE*           f           = fopen("/proc/self/statm", "r");
+	if( f ) {
+		if( fscanf(f, "%lu %lu", &size, &resident) != 2 ) {
+			resident    = 0;
+		}
+		fclose(f);
+	}
+	return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static
+double
+nowSec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static
+void
+run(const char* name, const VMParameters* params, uint32_t runs) {
+	double      best    = 1e9;
+	uint64_t    rss     = 0;
+	for( uint32_t r = 0; r < runs; ++r ) {
+		uint64_t    before  = residentBytes();
+		double      start   = nowSec();
+		VM*         vm      = vmNew(params);
+		double      elapsed = nowSec() - start;
+		uint64_t    after   = residentBytes();
+		vmRelease(vm);
+
+		// later runs may reuse what the allocator kept from the previous ones
+		best    = elapsed < best ? elapsed : best;
+		rss     = r == 0 && after > before ? after - before : rss;
+	}
+	fprintf(stdout, "%-8s vmNew %8.3f ms  RSS %8.1f KB\n", name, best * 1e3, (double)rss / 1024.0);
+}
+
+int
+main(int argc, char* argv[]) {
+	uint32_t        runs    = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : DEFAULT_RUNS;
+	VMParameters    params  = {
+		.maxProcCount           = 16384,
+		.maxFunctionCount       = 4096,
+		.maxInstructionCount    = 65536,
+		.maxCharSegmentSize     = 65536,
+		.maxFileCount           = 1024,
+		.maxCFCount             = 64,
+		.maxCISCount            = 65536,
+		.workerCount            = 4,
+	};
+	run("default", &params, runs);
+
+	params.maxProcCount         *= 64;
+	params.maxFunctionCount     *= 64;
+	params.maxInstructionCount  *= 64;
+	params.maxCharSegmentSize   *= 64;
+	params.maxCISCount          *= 64;
+	run("x64", &params, runs);
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "buffer.h"
+#include "mem-stats.h"
+#include "slab.h"
+
+// header and data share one slab block, the data follows the header
+#define BUFFER_HEADER   ((sizeof(Buffer) + 15) & ~(size_t)15)
+
+Buffer*
+Buffer_new(uint32_t size) {
+	Buffer* buf = Slab_alloc(BUFFER_HEADER + size);
+	if( buf == NULL ) {
+		return NULL;
+	}
+
+	atomic_init(&buf->refCount, 1);
+	buf->isFrozen   = false;
+	buf->size       = size;
+	buf->data       = (uint8_t*)buf + BUFFER_HEADER;
+	buf->root       = NULL;
+	memset(buf->data, 0, size);
+	MEM_TRACK(MEM_BUFFERS, (int64_t)Slab_size(buf));
+	return buf;
+}
+
+Buffer*
+Buffer_freeze(Buffer* buf) {
+	// the writes are published by whatever hands the buffer over (a message)
+	if( buf ) {
+		buf->isFrozen   = true;
+	}
+	return buf;
+}
+
+Buffer*
+Buffer_retain(Buffer* buf) {
+	if( buf ) {
+		atomic_fetch_add_explicit(&buf->refCount, 1, memory_order_relaxed);
+	}
+	return buf;
+}
+
+void
+Buffer_release(Buffer* buf) {
+	while( buf && atomic_fetch_sub_explicit(&buf->refCount, 1, memory_order_acq_rel) == 1 ) {
+		Buffer* root    = buf->root;
+		MEM_TRACK(MEM_BUFFERS, -(int64_t)Slab_size(buf));
+		Slab_free(buf);
+		buf = root;
+	}
+}
+
+Buffer*
+Buffer_slice(Buffer* buf, uint32_t offset, uint32_t size) {
+	if( buf == NULL || !buf->isFrozen || offset > buf->size || size > buf->size - offset ) {
+		return NULL;
+	}
+
+	Buffer* root    = buf->root ? buf->root : buf;
+	Buffer* slice   = Slab_alloc(sizeof(Buffer));
+	if( slice == NULL ) {
+		return NULL;
+	}
+
+	atomic_init(&slice->refCount, 1);
+	slice->isFrozen = true;
+	slice->size     = size;
+	slice->data     = buf->data + offset;
+	slice->root     = Buffer_retain(root);
+	MEM_TRACK(MEM_BUFFERS, (int64_t)Slab_size(slice));
+	return slice;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared Buffers
+////////////////////////////////////////////////////////////////////////////////
+//
+// reference counted byte buffers. A buffer is written by its creator, then
+// frozen: from then on it is immutable and can be shared between processes by
+// reference, every holder owning one reference. A slice is a frozen window on
+// a frozen buffer, it keeps its root alive and never copies.
+//
+
+typedef struct Buffer Buffer;
+
+struct Buffer {
+	atomic_uint     refCount;
+	bool            isFrozen;
+	uint32_t        size;
+	uint8_t*        data;
+	Buffer*         root;       // buffer holding the data of a slice, NULL for roots
+};
+
+/// Return: a zeroed mutable buffer holding one reference, NULL if out of memory
+Buffer*     Buffer_new(uint32_t size);
+
+/// make the buffer immutable, it must not be written anymore
+/// Return: buf, NULL is left as is
+Buffer*     Buffer_freeze(Buffer* buf);
+
+/// Return: buf with one more reference, NULL is left as is
+Buffer*     Buffer_retain(Buffer* buf);
+
+/// drop one reference, the last one frees the buffer (from any thread)
+void        Buffer_release(Buffer* buf);
+
+/// Return: a slice of size bytes from offset holding one reference, NULL if buf is NULL, not frozen or the range is out of bounds
+Buffer*     Buffer_slice(Buffer* buf, uint32_t offset, uint32_t size);
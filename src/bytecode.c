@@ -0,0 +1,133 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "bytecode.h"
+#include "module.h"
+
+#define CALL_BIT        0x80000000u
+#define SHORT_CALLS     0x80
+#define SHORT_LITERAL   0x80
+#define SHORT_LITERALS  0x40
+
+enum {
+	TAG_LITERAL     = 0xC0,
+	TAG_CALL_HW     = 0xC1,
+	TAG_CALL_EXTERN = 0xC2,
+	TAG_CALL_SELF   = 0xC3,
+	TAG_CALL        = 0xC4,
+};
+
+static inline
+uint32_t
+putLeb(uint32_t v, uint8_t* out) {
+	uint32_t    size    = 0;
+	while( v >= 0x80 ) {
+		out[size++] = (uint8_t)(v | 0x80);
+		v   >>= 7;
+	}
+	out[size++] = (uint8_t)v;
+	return size;
+}
+
+static inline
+uint32_t
+tagged(uint8_t tag, uint32_t v, uint8_t* out) {
+	out[0]  = tag;
+	return 1 + putLeb(v, &out[1]);
+}
+
+uint32_t
+Bytecode_encode(uint32_t ins, uint8_t* out) {
+	uint32_t    v   = ins & ~CALL_BIT;
+	if( (ins & CALL_BIT) == 0 ) {
+		return v < SHORT_LITERALS ? (out[0] = (uint8_t)(SHORT_LITERAL + v), 1) : tagged(TAG_LITERAL, v, out);
+	} else if( v < SHORT_CALLS ) {
+		out[0]  = (uint8_t)v;
+		return 1;
+	}
+
+	switch( MODULE_REF_MODULE(ins) ) {
+	case MODULE_HW:     return tagged(TAG_CALL_HW,     MODULE_REF_FUNCTION(ins), out);
+	case MODULE_EXTERN: return tagged(TAG_CALL_EXTERN, MODULE_REF_FUNCTION(ins), out);
+	case MODULE_SELF:   return tagged(TAG_CALL_SELF,   MODULE_REF_FUNCTION(ins), out);
+	default:            return tagged(TAG_CALL,        v, out);
+	}
+}
+
+size_t
+Bytecode_size(const uint32_t* ins, uint32_t count) {
+	uint8_t     out[BYTECODE_MAX_SIZE];
+	size_t      size    = 0;
+	for( uint32_t i = 0; i < count; ++i ) {
+		size    += Bytecode_encode(ins[i], out);
+	}
+	return size;
+}
+
+// Return: false if the code ends or v does not fit in max
+static inline
+bool
+getLeb(const uint8_t* code, size_t size, size_t* pos, uint32_t max, uint32_t* v) {
+	uint64_t    value   = 0;
+	for( uint32_t shift = 0; shift < 35 && *pos < size; shift += 7 ) {
+		uint8_t     b   = code[(*pos)++];
+		value   |= (uint64_t)(b & 0x7F) << shift;
+		if( (b & 0x80) == 0 ) {
+			*v  = (uint32_t)value;
+			return value <= max;
+		}
+	}
+	return false;
+}
+
+bool
+Bytecode_decode(const uint8_t* code, size_t size, size_t* pos, uint32_t* ins) {
+	if( *pos >= size ) {
+		return false;
+	}
+
+	uint8_t     tag = code[(*pos)++];
+	uint32_t    v;
+	if( tag < SHORT_CALLS ) {
+		*ins    = CALL_BIT | tag;
+		return true;
+	} else if( tag < SHORT_LITERAL + SHORT_LITERALS ) {
+		*ins    = tag - SHORT_LITERAL;
+		return true;
+	}
+
+	switch( tag ) {
+	case TAG_LITERAL:
+		return getLeb(code, size, pos, ~CALL_BIT, ins);
+	case TAG_CALL_HW:
+	case TAG_CALL_EXTERN:
+	case TAG_CALL_SELF:
+		if( !getLeb(code, size, pos, MODULE_FUNCTION_MASK, &v) ) {
+			return false;
+		}
+		*ins    = MODULE_REF(tag == TAG_CALL_HW ? MODULE_HW : tag == TAG_CALL_EXTERN ? MODULE_EXTERN : MODULE_SELF, v);
+		return true;
+	case TAG_CALL:
+		if( !getLeb(code, size, pos, ~CALL_BIT, &v) ) {
+			return false;
+		}
+		*ins    = CALL_BIT | v;
+		return true;
+	default:
+		return false;
+	}
+}
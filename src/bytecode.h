@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Compact Bytecode
+////////////////////////////////////////////////////////////////////////////////
+//
+// stored code (modules, compact images) is encoded with one byte per common
+// instruction, the VM runs the 32 bit form it expands to:
+//
+//  0x00 - 0x7F         : call of function 0 - 127 (opcodes and first natives)
+//  0x80 - 0xBF         : literal 0 - 63
+//  0xC0 <leb128>       : literal
+//  0xC1 <leb128>       : call of a function of module 0 (HW module, or any
+//                        function of the VM in images)
+//  0xC2 <leb128>       : call of an external function (MODULE_EXTERN)
+//  0xC3 <leb128>       : call of a function of the module (MODULE_SELF)
+//  0xC4 <leb128>       : any other call
+//
+// leb128 holds 7 bits per byte, least significant first, the high bit is set
+// on all bytes but the last. Literals of the 32 bit form are below 2^31 (see
+// vmPushCompilerLiteral).
+//
+
+#define BYTECODE_MAX_SIZE   6       // bytes of one encoded instruction
+
+/// Return: the bytes of ins written to out, at most BYTECODE_MAX_SIZE
+uint32_t    Bytecode_encode(uint32_t ins, uint8_t* out);
+
+/// Return: the bytes count instructions take once encoded
+size_t      Bytecode_size(const uint32_t* ins, uint32_t count);
+
+//
+// decode the instruction at *pos and move pos past it
+// Return: false if the code ends or the encoding is invalid
+//
+bool        Bytecode_decode(const uint8_t* code, size_t size, size_t* pos, uint32_t* ins);
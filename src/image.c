@@ -0,0 +1,544 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "internals.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// VM Images
+////////////////////////////////////////////////////////////////////////////////
+//
+// file layout:
+//
+//  ImageHeader | ImageFunction[funcCount] | pad | code segment | pad | char segment | relocations
+//
+// the code and char segments start on IMAGE_ALIGN boundaries so their whole
+// pages can be mapped straight from the file. A compact image stores the code
+// in the compact bytecode (bytecode.h) instead and packs its sections, the code
+// is decoded and the chars are copied when loaded. The
+// relocations list the code offsets holding function literals, they are
+// copied. Natives are saved by name only, they are bound again to the natives
+// of the loading VM. Opcodes are natives without an entry point, they are
+// dispatched by index and must keep theirs.
+//
+
+#define IMAGE_MAGIC     "ncvmimg"
+#define IMAGE_VERSION   3
+#define IMAGE_ALIGN     65536
+
+typedef struct {
+	char        magic[8];
+	uint32_t    version;
+	uint32_t    funcCount;
+	uint32_t    insCount;
+	uint32_t    charCount;
+	uint64_t    insOffset;      // file offset of the code segment
+	uint64_t    charOffset;     // file offset of the char segment
+	uint32_t    relocCount;
+	uint64_t    relocOffset;    // file offset of the relocations
+	uint32_t    isCompact;      // the code is encoded, codeSize bytes
+	uint32_t    codeSize;
+} ImageHeader;
+
+typedef struct {
+	uint32_t    type;
+	uint32_t    isImmediate;
+	uint32_t    nameOffset;
+	uint32_t    inVS;
+	uint32_t    outVS;
+	uint32_t    insOffset;      // interpreted functions only
+	uint32_t    insCount;
+} ImageFunction;
+
+static inline
+uint64_t
+alignUp(uint64_t size, uint64_t align) {
+	return (size + align - 1) & ~(align - 1);
+}
+
+static
+bool
+writeAt(FILE* f, uint64_t offset, const void* data, size_t size) {
+	return fseek(f, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, size, f) == size;
+}
+
+// the segments written to an image, those of the VM or compacted copies
+typedef struct {
+	const Function* funcs;
+	uint32_t        funcCount;
+	const uint32_t* ins;
+	uint32_t        insCount;
+	const char*     chars;
+	uint32_t        charCount;
+	const uint32_t* relocs;
+	uint32_t        relocCount;
+} ImageSegments;
+
+// Return: the bytes of the code segment as stored, NULL if out of memory
+static
+uint8_t*
+encodeCode(const ImageSegments* seg, uint32_t* codeSize) {
+	size_t      size    = Bytecode_size(seg->ins, seg->insCount);
+	uint8_t*    code    = size <= UINT32_MAX ? malloc(size + 1) : NULL;
+	for( uint32_t i = 0, pos = 0; code && i < seg->insCount; ++i ) {
+		pos += Bytecode_encode(seg->ins[i], &code[pos]);
+	}
+	*codeSize   = (uint32_t)size;
+	return code;
+}
+
+static
+bool
+writeImage(const char* path, const ImageSegments* seg, bool isCompact) {
+	ImageHeader hdr = {
+		.magic      = IMAGE_MAGIC,
+		.version    = IMAGE_VERSION,
+		.funcCount  = seg->funcCount,
+		.insCount   = seg->insCount,
+		.charCount  = seg->charCount,
+		.relocCount = seg->relocCount,
+		.isCompact  = isCompact,
+	};
+	const void* code    = seg->ins;
+	uint64_t    size    = (uint64_t)seg->insCount * sizeof(uint32_t);
+	uint8_t*    encoded = NULL;
+	if( isCompact ) {
+		if( (encoded = encodeCode(seg, &hdr.codeSize)) == NULL ) {
+			fprintf(stderr, "Error: image %s cannot be encoded\n", path);
+			return false;
+		}
+		code    = encoded;
+		size    = hdr.codeSize;
+	}
+	// a compact image is copied, not mapped, its sections are packed
+	uint64_t    align   = isCompact ? 1 : IMAGE_ALIGN;
+	hdr.insOffset   = alignUp(sizeof(ImageHeader) + (uint64_t)seg->funcCount * sizeof(ImageFunction), align);
+	hdr.charOffset  = alignUp(hdr.insOffset + size, align);
+	hdr.relocOffset = alignUp(hdr.charOffset + seg->charCount, sizeof(uint32_t));
+
+	// written aside and renamed, the image being replaced may be the one mapped
+	// by vmImageLoad, truncating it would fault the running code
+	char    tmpName[MAX_TOKEN_SIZE + 8];
+	FILE*   f   = NULL;
+	if( snprintf(tmpName, sizeof(tmpName), "%s.tmp", path) >= (int)sizeof(tmpName)
+	 || (f = fopen(tmpName, "wb")) == NULL ) {
+		fprintf(stderr, "Error: image %s cannot be created\n", path);
+		free(encoded);
+		return false;
+	}
+
+	bool    isOk    = writeAt(f, 0, &hdr, sizeof(ImageHeader));
+	for( uint32_t fidx = 0; isOk && fidx < seg->funcCount; ++fidx ) {
+		const Function* func    = &seg->funcs[fidx];
+		ImageFunction   entry   = {
+			.type           = func->type,
+			.isImmediate    = func->isImmediate,
+			.nameOffset     = func->nameOffset,
+			.inVS           = func->inVS,
+			.outVS          = func->outVS,
+			.insOffset      = func->type == FT_INTERP ? func->u.interp.insOffset : 0,
+			.insCount       = func->type == FT_INTERP ? func->u.interp.insCount  : 0,
+		};
+		isOk    = fwrite(&entry, sizeof(ImageFunction), 1, f) == 1;
+	}
+	isOk    = isOk
+	       && writeAt(f, hdr.insOffset, code, (size_t)size)
+	       && writeAt(f, hdr.charOffset, seg->chars, seg->charCount)
+	       && writeAt(f, hdr.relocOffset, seg->relocs, (size_t)seg->relocCount * sizeof(uint32_t));
+	// the file reaches the relocations even without any, vmImageLoad checks it
+	isOk    = isOk && (seg->relocCount != 0 || (fflush(f) == 0 && ftruncate(fileno(f), (off_t)hdr.relocOffset) == 0));
+	isOk    = (fclose(f) == 0) && isOk;
+	isOk    = isOk ? rename(tmpName, path) == 0 : (unlink(tmpName), false);
+	free(encoded);
+
+	if( !isOk ) {
+		fprintf(stderr, "Error: image %s cannot be written\n", path);
+	}
+	return isOk;
+}
+
+// Return: false if a function is being compiled, the image would miss it
+static
+bool
+canSave(const VM* vm, const char* path) {
+	if( vm->compilerState.cfsCount ) {
+		fprintf(stderr, "Error: image %s not saved, a function is being compiled\n", path);
+		return false;
+	}
+	return true;
+}
+
+// Return: false if the lazy function fidx cannot be materialized, images hold code
+static
+bool
+materialize(VM* vm, uint32_t fidx, const char* path) {
+	ExceptFlags flags   = { .all = 0 };
+	if( vm->funcs[fidx].type == FT_LAZY && !vmModuleMaterialize(vm, fidx, &flags) ) {
+		fprintf(stderr, "Error: image %s not saved, the code segment is full\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool
+vmImageSave(VM* vm, const char* path, bool isCompact) {
+	if( !canSave(vm, path) ) {
+		return false;
+	}
+
+	// the image holds code, not the modules it was loaded from
+	for( uint32_t fidx = 0; fidx < vm->funcCount; ++fidx ) {
+		if( !materialize(vm, fidx, path) ) {
+			return false;
+		}
+	}
+
+	ImageSegments   seg = {
+		.funcs  = vm->funcs,    .funcCount  = vm->funcCount,
+		.ins    = vm->ins,      .insCount   = vm->insCount,
+		.chars  = vm->chars,    .charCount  = vm->charCount,
+		.relocs = vm->relocs,   .relocCount = vm->relocCount,
+	};
+	return writeImage(path, &seg, isCompact);
+}
+
+//
+// r is the first relocation at or after insOffset, it is moved past insOffset
+// Return: the function the instruction at insOffset calls or refers to as a
+//         literal (lambda, word address), VM_NO_FUNCTION if none
+//
+static inline
+uint32_t
+calleeAt(const VM* vm, uint32_t insOffset, uint32_t* r, bool* isRef) {
+	uint32_t    op  = vm->ins[insOffset];
+	*isRef  = *r < vm->relocCount && vm->relocs[*r] == insOffset;
+	*r      += *isRef;
+	return *isRef ? op : (op & OP_CALL) ? op & OP_CALL_MASK : VM_NO_FUNCTION;
+}
+
+//
+// mark the natives and the functions reachable from the roots, the lazy ones
+// reached are materialized
+// Return: false if a lazy function cannot be materialized
+//
+static
+bool
+markReachable(VM* vm, const char* path, const uint32_t* roots, uint32_t rootCount, bool* keep, uint32_t* stack) {
+	uint32_t    top = 0;
+	for( uint32_t fidx = 0; fidx < vm->funcCount; ++fidx ) {
+		keep[fidx]  = vm->funcs[fidx].type == FT_NATIVE;
+	}
+	for( uint32_t i = 0; i < rootCount; ++i ) {
+		if( roots[i] < vm->funcCount && !keep[roots[i]] ) {
+			keep[roots[i]]  = true;
+			stack[top++]    = roots[i];
+		}
+	}
+
+	// every function is pushed once, when marked
+	while( top ) {
+		uint32_t    fidx    = stack[--top];
+		if( !materialize(vm, fidx, path) ) {
+			return false;
+		}
+		const InterpFunction*   body    = &vm->funcs[fidx].u.interp;
+		uint32_t                r       = vmFirstRelocation(vm, body->insOffset);
+		for( uint32_t i = body->insOffset; i < body->insOffset + body->insCount; ++i ) {
+			bool        isRef;
+			uint32_t    callee  = calleeAt(vm, i, &r, &isRef);
+			if( callee < vm->funcCount && !keep[callee] ) {
+				keep[callee]    = true;
+				stack[top++]    = callee;
+			}
+		}
+	}
+	return true;
+}
+
+bool
+vmImageShake(VM* vm, const char* path, const uint32_t* roots, uint32_t rootCount, bool isCompact) {
+	if( !canSave(vm, path) ) {
+		return false;
+	}
+
+	uint32_t    funcCount   = vm->funcCount;
+	bool*       keep        = malloc(funcCount + 1);
+	uint32_t*   newIdx      = malloc(((size_t)funcCount + 1) * sizeof(uint32_t));
+	// newIdx is the work list while marking
+	bool        isOk        = keep && newIdx && markReachable(vm, path, roots, rootCount, keep, newIdx);
+
+	// the kept functions are renumbered in order, the opcodes keep their index
+	// and a shadowed word that is still called stays behind its successor
+	ImageSegments   seg     = { 0 };
+	uint32_t        insCount    = 0;
+	uint32_t        charCount   = 0;
+	for( uint32_t fidx = 0; isOk && fidx < funcCount; ++fidx ) {
+		if( keep[fidx] ) {
+			newIdx[fidx]    = seg.funcCount++;
+			charCount       += vm->funcs[fidx].nameOffset != VM_NO_NAME ? (uint32_t)strlen(&vm->chars[vm->funcs[fidx].nameOffset]) + 1 : 0;
+			insCount        += vm->funcs[fidx].type == FT_INTERP ? vm->funcs[fidx].u.interp.insCount : 0;
+		}
+	}
+
+	Function*   funcs   = isOk ? malloc(((size_t)seg.funcCount + 1) * sizeof(Function)) : NULL;
+	uint32_t*   ins     = isOk ? malloc(((size_t)insCount + 1) * sizeof(uint32_t)) : NULL;
+	uint32_t*   relocs  = isOk ? malloc(((size_t)insCount + 1) * sizeof(uint32_t)) : NULL;
+	char*       chars   = isOk ? malloc((size_t)charCount + 1) : NULL;
+	isOk    = funcs && ins && relocs && chars;
+
+	for( uint32_t fidx = 0, f = 0; isOk && fidx < funcCount; ++fidx ) {
+		if( !keep[fidx] ) {
+			continue;
+		}
+		Function    func    = vm->funcs[fidx];
+		if( func.nameOffset != VM_NO_NAME ) {
+			const char* name    = &vm->chars[func.nameOffset];
+			size_t      size    = strlen(name) + 1;
+			memcpy(&chars[seg.charCount], name, size);
+			func.nameOffset = seg.charCount;
+			seg.charCount   += (uint32_t)size;
+		}
+
+		if( func.type == FT_INTERP ) {
+			uint32_t    r   = vmFirstRelocation(vm, func.u.interp.insOffset);
+			for( uint32_t i = func.u.interp.insOffset; i < func.u.interp.insOffset + func.u.interp.insCount; ++i ) {
+				bool        isRef;
+				uint32_t    callee  = calleeAt(vm, i, &r, &isRef);
+				if( callee >= funcCount ) {
+					ins[seg.insCount]   = vm->ins[i];
+				} else if( isRef ) {
+					relocs[seg.relocCount++]    = seg.insCount;
+					ins[seg.insCount]   = newIdx[callee];
+				} else {
+					ins[seg.insCount]   = OP_CALL | newIdx[callee];
+				}
+				++seg.insCount;
+			}
+			func.u.interp.insOffset = seg.insCount - func.u.interp.insCount;
+		}
+		funcs[f++]  = func;
+	}
+
+	if( isOk ) {
+		seg.funcs   = funcs;
+		seg.ins     = ins;
+		seg.chars   = chars;
+		seg.relocs  = relocs;
+		isOk    = writeImage(path, &seg, isCompact);
+	}
+
+	free(keep);
+	free(newIdx);
+	free(funcs);
+	free(ins);
+	free(relocs);
+	free(chars);
+	return isOk;
+}
+
+// Return: the native of the loading VM named name, VM_NO_FUNCTION if none
+static
+uint32_t
+findNative(const VM* vm, const char* name) {
+	for( uint32_t fidx = vm->funcCount; fidx > 0; --fidx ) {
+		const Function* func    = &vm->funcs[fidx - 1];
+		if( func->type == FT_NATIVE && strcmp(name, &vm->chars[func->nameOffset]) == 0 ) {
+			return fidx - 1;
+		}
+	}
+	return VM_NO_FUNCTION;
+}
+
+//
+// rebuild the function table of the image, natives bound by name
+// Return: false if the table is corrupt or names a native the VM does not have
+//
+static
+bool
+bindFunctions(const VM* vm, const ImageHeader* hdr, const uint8_t* img, Function* funcs) {
+	const ImageFunction*    entries = (const ImageFunction*)(img + sizeof(ImageHeader));
+	const char*             chars   = (const char*)(img + hdr->charOffset);
+
+	// opcodes are dispatched by index, an image of a VM with other opcodes would
+	// run its natives and words as opcodes
+	uint32_t                opcodes = vmOpcodeCount();
+	if( hdr->funcCount < opcodes ) {
+		fprintf(stderr, "Error: image opcodes differ from the VM ones\n");
+		return false;
+	}
+
+	for( uint32_t fidx = 0; fidx < hdr->funcCount; ++fidx ) {
+		// lambdas are interpreted functions without a name
+		const ImageFunction*    entry   = &entries[fidx];
+		bool                    isAnon  = entry->nameOffset == VM_NO_NAME && entry->type == FT_INTERP;
+		if( entry->nameOffset >= hdr->charCount && !isAnon ) {
+			return false;
+		}
+
+		const char* name    = isAnon ? NULL : &chars[entry->nameOffset];
+		funcs[fidx] = (Function) {
+			.type           = (FunctionType)entry->type,
+			.isImmediate    = entry->isImmediate != 0,
+			.nameOffset     = entry->nameOffset,
+			.inVS           = entry->inVS,
+			.outVS          = entry->outVS,
+		};
+
+		if( entry->type == FT_INTERP ) {
+			if( fidx < opcodes || entry->insOffset > hdr->insCount || entry->insCount > hdr->insCount - entry->insOffset ) {
+				return false;
+			}
+			funcs[fidx].u.interp    = (InterpFunction) { .insOffset = entry->insOffset, .insCount = entry->insCount };
+		} else if( entry->type == FT_NATIVE ) {
+			uint32_t    native  = findNative(vm, name);
+			if( native == VM_NO_FUNCTION || (vm->funcs[native].u.native == NULL && native != fidx) ) {
+				fprintf(stderr, "Error: image native %s is not available\n", name);
+				return false;
+			} else if( (fidx < opcodes || native < opcodes) && native != fidx ) {
+				fprintf(stderr, "Error: image opcodes differ from the VM ones\n");
+				return false;
+			}
+			funcs[fidx].u.native    = vm->funcs[native].u.native;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Return: false if the relocations are not ascending offsets into the code
+static
+bool
+checkRelocations(const ImageHeader* hdr, const uint32_t* relocs) {
+	for( uint32_t r = 0; r < hdr->relocCount; ++r ) {
+		if( relocs[r] >= hdr->insCount || (r > 0 && relocs[r] <= relocs[r - 1]) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Return: false if the compact code does not decode to exactly insCount instructions
+static
+bool
+checkCode(const ImageHeader* hdr, const uint8_t* code) {
+	size_t      pos = 0;
+	uint32_t    ins;
+	for( uint32_t i = 0; i < hdr->insCount; ++i ) {
+		if( !Bytecode_decode(code, hdr->codeSize, &pos, &ins) ) {
+			return false;
+		}
+	}
+	return pos == hdr->codeSize;
+}
+
+//
+// replace the first size bytes of a segment by the same bytes of the file at
+// offset: the whole pages are mapped read only from the file, the last partial
+// page is copied so the segment keeps growing in place. Sections not starting
+// on a page are copied. The range used before is reset first, it may hold the
+// read only pages of a previous image
+//
+static
+bool
+mapSegment(const VM* vm, void* segment, size_t usedBefore, int fd, const uint8_t* img, uint64_t offset, size_t size) {
+	size_t  reset   = usedBefore > size ? usedBefore : size;
+	reset   = (size_t)alignUp(reset, vm->pageSize);
+	if( reset && mmap(segment, reset, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED ) {
+		return false;
+	}
+
+	size_t  mapped  = offset % vm->pageSize == 0 ? size & ~(vm->pageSize - 1) : 0;
+	if( mapped && mmap(segment, mapped, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset) == MAP_FAILED ) {
+		return false;
+	}
+	memcpy((uint8_t*)segment + mapped, img + offset + mapped, size - mapped);
+	return true;
+}
+
+bool
+vmImageLoad(VM* vm, const char* path) {
+	if( vm->compilerState.cfsCount ) {
+		fprintf(stderr, "Error: image %s not loaded, a function is being compiled\n", path);
+		return false;
+	}
+
+	int     fd  = open(path, O_RDONLY);
+	if( fd < 0 ) {
+		fprintf(stderr, "Error: image %s cannot be opened\n", path);
+		return false;
+	}
+
+	struct stat st;
+	uint8_t*    img     = MAP_FAILED;
+	Function*   funcs   = NULL;
+	bool        isOk    = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ImageHeader)
+	                   && (img = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED;
+
+	// the sections are laid out in order, the relocations bound them all by the file size
+	const ImageHeader*  hdr = (const ImageHeader*)img;
+	isOk    = isOk
+	       && memcmp(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic)) == 0
+	       && hdr->version == IMAGE_VERSION
+	       && hdr->funcCount <= vm->funCap && hdr->insCount <= vm->insCap && hdr->charCount <= vm->charCap
+	       && (hdr->isCompact || (hdr->insOffset % IMAGE_ALIGN == 0 && hdr->charOffset % IMAGE_ALIGN == 0))
+	       && sizeof(ImageHeader) + (uint64_t)hdr->funcCount * sizeof(ImageFunction) <= hdr->insOffset
+	       && hdr->insOffset + (hdr->isCompact ? hdr->codeSize : (uint64_t)hdr->insCount * sizeof(uint32_t)) <= hdr->charOffset
+	       && hdr->charOffset + hdr->charCount <= hdr->relocOffset && hdr->relocOffset % sizeof(uint32_t) == 0
+	       && hdr->relocCount <= hdr->insCount
+	       && hdr->relocOffset + (uint64_t)hdr->relocCount * sizeof(uint32_t) <= (uint64_t)st.st_size
+	       && (hdr->charCount == 0 || img[hdr->charOffset + hdr->charCount - 1] == '\0')
+	       && checkRelocations(hdr, (const uint32_t*)(img + hdr->relocOffset))
+	       && (!hdr->isCompact || checkCode(hdr, img + hdr->insOffset));
+	if( !isOk ) {
+		fprintf(stderr, "Error: %s is not a valid image\n", path);
+	}
+
+	isOk    = isOk
+	       && (funcs = malloc((size_t)hdr->funcCount * sizeof(Function) + 1)) != NULL
+	       && bindFunctions(vm, hdr, img, funcs);
+
+	// the segments are only replaced once the whole image checked out. Mapping
+	// over our own reservation only fails when the system is out of mappings,
+	// the segments are then left half replaced
+	if( isOk ) {
+		size_t  insSize = hdr->isCompact ? 0 : (size_t)hdr->insCount * sizeof(uint32_t);
+		isOk    = mapSegment(vm, vm->ins, (size_t)vm->insCount * sizeof(uint32_t), fd, img, hdr->insOffset, insSize)
+		       && mapSegment(vm, vm->chars, vm->charCount, fd, img, hdr->charOffset, hdr->charCount);
+		for( size_t i = 0, pos = 0; isOk && hdr->isCompact && i < hdr->insCount; ++i ) {
+			Bytecode_decode(img + hdr->insOffset, hdr->codeSize, &pos, &vm->ins[i]);
+		}
+		if( isOk ) {
+			memcpy(vm->funcs, funcs, (size_t)hdr->funcCount * sizeof(Function));
+			memcpy(vm->relocs, img + hdr->relocOffset, (size_t)hdr->relocCount * sizeof(uint32_t));
+			vmSetSegmentCounts(vm, hdr->funcCount, hdr->insCount, hdr->charCount, hdr->relocCount);
+			vmModuleReleaseAll(vm);     // no lazy function is left
+		} else {
+			fprintf(stderr, "Error: image %s cannot be mapped\n", path);
+		}
+	}
+
+	free(funcs);
+	if( img != MAP_FAILED ) {
+		munmap(img, (size_t)st.st_size);
+	}
+	close(fd);
+	return isOk;
+}
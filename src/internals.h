@@ -24,6 +24,15 @@
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <pthread.h>
+
+#include "lock-free/lock-free.h"
+#include "timer-wheel.h"
+#include "slab.h"
+#include "buffer.h"
+#include "mem-stats.h"
+#include "module.h"
+#include "bytecode.h"
 
 #ifdef NDEBUG
 #   define log(...)
@@ -49,16 +58,35 @@ typedef struct Process  Process;
 
 #define MAX_TOKEN_SIZE  1023
 
+#define DEFAULT_REDUCTION_BUDGET    2000    // calls/tail calls/conds per time slice
+
+// default hard limits of the growable segments, only the address space is
+// reserved up front (see vmNew)
+#define VM_MAX_FUNCTIONS        (1u << 20)
+#define VM_MAX_INSTRUCTIONS     (1u << 26)
+#define VM_MAX_CHARS            (1u << 26)
+
+#define VM_NO_FUNCTION          0xFFFFFFFF
+#define VM_NO_NAME              0xFFFFFFFF  // nameOffset of anonymous functions (lambdas)
+#define VM_NAME_SIZE            24          // buffer of vmFunctionName
+
 typedef struct {
 	uint32_t        insOffset;
 	uint32_t        insCount;
 } InterpFunction;
 
+// a module function whose code was not copied yet (see vmModuleMaterialize)
+typedef struct {
+	uint32_t        module;     // index in vm->modules.list
+	uint32_t        function;   // index in the module function table
+} LazyFunction;
+
 typedef void (*NativeFunction)(Process* proc);
 
 typedef enum {
 	FT_INTERP   = 0,
 	FT_NATIVE   = 1,
+	FT_LAZY     = 2,    // interpreted once materialized, on its first fetch
 } FunctionType;
 
 typedef struct {
@@ -70,15 +98,10 @@ typedef struct {
 	union {
 		InterpFunction  interp;
 		NativeFunction  native;
+		LazyFunction    lazy;
 	} u;
 } Function;
 
-typedef struct {
-	uint32_t        fp;     // function pointer
-	uint32_t        ip;     // next instruction address
-	uint32_t        lp;     // last local value stack address
-} Return;
-
 typedef union {
 	bool            b;
 	char            c;
@@ -95,6 +118,40 @@ typedef union {
 	void*           ref;
 } Value;
 
+//
+// a lambda and the values it captured when created (clo.new). call and cond
+// take either a lambda (a function index, the upper half of the value clear)
+// or a closure: its address tagged with VM_CLOSURE_TAG, a bit user space
+// addresses never set. Closures are allocated like map buffers and released
+// with clo.free, or with the process region
+//
+typedef struct {
+	uint32_t        func;       // lambda run by call/cond
+	uint32_t        count;      // captured values
+	Value           values[];   // read by clo.read
+} Closure;
+
+#define VM_CLOSURE_TAG          0x8000000000000000ull
+
+INLINE
+bool
+vmIsClosure(Value v) {
+	return (v.u64 & VM_CLOSURE_TAG) != 0;
+}
+
+INLINE
+Closure*
+vmClosureOf(Value v) {
+	return (Closure*)(uintptr_t)(v.u64 & ~VM_CLOSURE_TAG);
+}
+
+typedef struct {
+	uint32_t        fp;     // function pointer
+	uint32_t        ip;     // next instruction address
+	uint32_t        lp;     // last local value stack address
+	const Closure*  closure;// closure of the function, NULL for a plain function
+} Return;
+
 typedef enum {
 	SM_RO,
 	SM_WO,
@@ -116,6 +173,55 @@ typedef struct {
 	uint32_t*       strings;
 } StringStack;
 
+typedef enum {
+	SK_VALUE    = 0,
+	SK_RETURN,
+	SK_LOCAL,
+	SK_COUNT
+} StackKind;
+
+//
+// accessible part of a guarded stack: pages from start up to start + open can
+// be used, the rest up to start + size is PROT_NONE and opened on demand when a
+// push faults on it, the page at start + size is the guard
+//
+typedef struct {
+	uint8_t*        start;      // page holding the bottom of the stack
+	size_t          open;
+	size_t          size;
+} StackWindow;
+
+//
+// a lambda run on its own guarded value and return stacks inside a process.
+// gen.next and gen.yield swap the stacks and the execution position of the
+// process with the ones kept here, the scheduler is not involved. Locals are
+// shared with the process
+//
+typedef struct Generator Generator;
+struct Generator {
+	// the side that is not running: the generator while it is suspended, whoever
+	// resumed it while it runs
+	Value*          vs;
+	uint32_t        vsCount;
+	uint32_t        vsCap;
+	Return*         rs;
+	uint32_t        rsCount;
+	uint32_t        rsCap;
+	StackWindow     windows[SK_LOCAL];  // value and return stacks
+	Return          pos;                // where that side continues
+
+	Generator*      resumer;    // generator that ran gen.next, NULL for the process stacks
+	bool            isRunning;
+	bool            isDone;     // its lambda returned
+	void*           arena;      // mapping of its stacks
+	size_t          arenaSize;
+	Generator*      next;       // generators of the process, released with it
+	Generator*      prev;
+};
+
+#define GEN_VALUE_COUNT     256
+#define GEN_RETURN_COUNT    128
+
 typedef union {
 	uint32_t        all;
 	struct {
@@ -127,6 +233,8 @@ typedef union {
 		bool            insOF   : 1;    // instruction count overflow flag
 		bool            chOF    : 1;    // character segment overflow flag
 		bool            yF      : 1;    // yield flag
+		bool            lsOF    : 1;    // local stack overflow flag
+		bool            cloF    : 1;    // closure or generator of no function, closure of a closure, capture out of range
 	} indiv;
 } ExceptFlags;
 
@@ -139,6 +247,28 @@ typedef struct {
 	uint32_t	ptr;
 } ProcPtr;
 
+typedef enum {
+	PP_HIGH     = 0,    // latency critical, always drained first
+	PP_NORMAL   = 1,
+	PP_LOW      = 2,    // bulk/background work
+	PP_COUNT,
+} ProcPriority;
+
+typedef enum {
+	PS_RUNNING  = 0,    // executed by a worker (or not scheduled at all, like the repl)
+	PS_RUNNABLE,        // in a run queue
+	PS_WAITING,         // parked until vmWake
+	PS_WOKEN,           // woken up while still running, goes back to its run queue
+} ProcState;
+
+typedef struct {
+	void*           addr;
+	uint32_t        size;
+	bool            isShared;   // addr is a frozen Buffer, the message holds one reference
+} Message;
+
+#define PROC_OPEN   0x80000000u    // Process.pins: the mailbox takes messages
+
 struct Process {
 	VM*             vm;         // root VM
     ProcPtr         parent;     // parent process
@@ -163,12 +293,54 @@ struct Process {
 
 	StringStack     ss;         // string stack
 
+	void*           arena;      // reserved range holding all the stacks above, the
+	size_t          arenaSize;  // value, return and local stacks end at a guard page
+	StackWindow     windows[SK_COUNT];  // growable part of the guarded stacks
+
+	SlabRegion      region;     // map allocations when useRegion, released in one go on exit
+	bool            useRegion;  // (inherited by spawned processes)
+
+	struct {
+		int64_t         used;       // bytes allocated minus bytes freed by the process (MEM_STATS)
+		int64_t         peak;
+	}               mem;
+
 	uint32_t        fp;         // current executing function
 	uint32_t        ip;         // pointer to the next instruction to fetch
 	uint32_t        lp;         // local stack pointer
+	const Closure*  closure;    // last closure entered by call/cond, captures read by clo.read
+	Generator*      gen;        // running generator, NULL on the process stacks
+	Generator*      gens;       // generators created and not freed yet
 
 	ExceptFlags     exceptFlags;
 
+	uint32_t        reductions;         // reductions left before the process is descheduled
+	uint32_t        reductionBudget;    // reductions granted per time slice
+
+	ProcPriority    priority;   // run queue lane
+	atomic_uint     state;      // ProcState
+	BoundedQueue    mailbox;    // incoming messages (Message*)
+
+	// the first process sending to this one gets a private SPSC ring, a 1:1
+	// pipeline never touches the MPMC mailbox. The owner allocates the ring when
+	// it claims the link, most processes never get one. Claims and pushes are
+	// made with the slot pinned, the ring is freed once the slot is closed
+	struct {
+		SpscQueue       ring;       // messages from owner (Message*)
+		_Atomic uint64_t owner;     // pid + 1 of the producer, 0: unclaimed
+		atomic_bool     isReady;    // ring allocated, published by the owner
+		bool            isFirst;    // receive alternates between ring and mailbox
+	}               link;
+
+	struct {
+		Timer           timer;      // sleep/receive timeout
+		atomic_bool     expired;    // timer fired
+		bool            isArmed;    // timer started and not consumed yet
+		bool            requested;  // park the process at the end of the slice
+	}               wait;
+
+	Timer           ticker;     // periodic empty messages (tick.every)
+
 	struct {
 		bool            isTail;
 		uint32_t        opcode;
@@ -190,18 +362,61 @@ struct Process {
 		Value           s1;         // 2nd arg
 		Value           s0;         // 1st arg
 	}               readState;
+
+	// senders holding the slot (low bits) and PROC_OPEN while the mailbox takes
+	// messages. The slot is closed and drained before its queues are freed, the
+	// field is kept when the slot is cleared, see pinProcess
+	_Atomic uint32_t pins;
 };
 
+typedef struct {
+	VM*             vm;
+	uint32_t        id;
+	uint32_t        picks;      // processes picked so far (used for aging)
+	pthread_t       thread;
+} Worker;
+
+typedef struct {
+	BoundedQueue    runQueues[PP_COUNT];    // runnable processes, one lane per priority
+
+	// released process slots form a stack linked through freeLinks, the head is
+	// tagged against ABA. Slots from slotTop on were never used, their memory
+	// is never touched
+	uint32_t*       freeLinks;              // next free slot + 1 of each free slot
+	_Atomic uint64_t freeHead;              // tag << 32 | (slot + 1), 0: empty
+	atomic_uint     slotTop;
+
+	uint32_t        workerCount;
+	Worker*         workers;
+
+	pthread_mutex_t parkLock;
+	pthread_cond_t  parkCond;
+	atomic_uint     parkedCount;            // workers waiting for work
+	atomic_bool     stop;
+
+	// timers run on 1ms ticks since startNs, workers advance the wheel and park
+	// until its next expiry
+	pthread_mutex_t timerLock;
+	TimerWheel      timers;
+	_Atomic uint64_t nextExpiry;            // cached TimerWheel_nextExpiry
+	uint64_t        startNs;
+} Scheduler;
+
 struct VM {
 	bool            quit;
 
 	uint32_t        funcCount;
 	uint32_t        funCap;
 	Function*       funcs;      // function segment
+	uint32_t        wordCount;
+	uint32_t*       words;      // dictionary: named functions in definition order (funCap entries)
 
 	uint32_t        insCount;
 	uint32_t        insCap;
 	uint32_t*       ins;        // code segment
+	uint32_t        relocCount;
+	uint32_t*       relocs;     // code offsets holding function literals (ascending, insCap entries)
+	pthread_mutex_t codeLock;   // appends to the code segment (compiler, lazy functions)
 
 	uint32_t        charCount;
 	uint32_t        charCap;
@@ -210,6 +425,7 @@ struct VM {
 	uint32_t        procCount;  // process count
 	uint32_t        procCap;    // max processes
 	Process*        procs;      // process list
+	size_t          pageSize;
 
 	// compiler section
 	uint32_t        strmCount;
@@ -224,13 +440,66 @@ struct VM {
 		uint32_t        cisCount;   // compiler instruction count
 		uint32_t        cisCap;
 		uint32_t*       cis;
+
+		uint32_t        refCount;   // compiler instructions holding function literals
+		uint32_t*       refs;       // their cis indices (ascending, cisCap entries)
+
+		ModuleRecorder* recorder;   // file being loaded, NULL outside of load
 	}               compilerState;
 
+	struct {
+		LoadedModule*   list;       // mapped modules, lazy functions copy their code from there
+		uint32_t        count;
+		uint32_t        cap;
+		uint32_t        lazyCount;  // functions loaded from modules
+		_Atomic uint32_t    materialized;   // of which were fetched at least once
+	}               modules;
+
+	Scheduler       sched;
+	bool            reportLeaks;
 };
 
 #define ABORT_ON_EXCEPTIONS()       { if( proc->exceptFlags.all ) { return; } }
 #define ABORT_ON_EXCEPTIONS_V(V)    { if( proc->exceptFlags.all ) { return V; } }
 
+//
+// account bytes to a category and to the process allocating (bytes > 0) or
+// freeing (bytes < 0) them, proc is NULL outside of processes. A buffer freed
+// by another process is credited to that one. Compiled out without MEM_STATS,
+// the arguments are not evaluated then but still count as used
+//
+#ifdef MEM_STATS
+INLINE
+void
+vmMemTrack(Process* proc, MemCategory cat, int64_t bytes) {
+	MemStats_add(cat, bytes);
+	if( proc ) {
+		// only the worker running the process writes, readers may be elsewhere
+		int64_t     used    = atomic_load_explicit(&proc->mem.used, memory_order_relaxed) + bytes;
+		atomic_store_explicit(&proc->mem.used, used, memory_order_relaxed);
+		if( used > atomic_load_explicit(&proc->mem.peak, memory_order_relaxed) ) {
+			atomic_store_explicit(&proc->mem.peak, used, memory_order_relaxed);
+		}
+	}
+}
+#else
+#   define vmMemTrack(proc, cat, bytes)    ((void)sizeof(proc), (void)sizeof(cat), (void)sizeof(bytes))
+#endif
+
+/// Return: bytes held by the link ring of proc, 0 until its owner allocated it
+INLINE
+int64_t
+vmLinkBytes(const Process* proc) {
+	return atomic_load_explicit(&proc->link.isReady, memory_order_acquire) ? (int64_t)((proc->link.ring.mask + 1) * sizeof(void*)) : 0;
+}
+
+/// Return: bytes held by the mailbox and the link ring of proc
+INLINE
+int64_t
+vmMailboxBytes(const Process* proc) {
+	return (int64_t)(proc->mailbox.cap * sizeof(*proc->mailbox.elements)) + vmLinkBytes(proc);
+}
+
 #define STOP_IF(FLAG, COND)     { \
 		ABORT_ON_EXCEPTIONS() \
 		if( (vm->flags.exceptFlags.indiv.FLAG = COND) ) { return; } } \
@@ -258,14 +527,20 @@ void        vmPopString     (Process* proc);
 /// return the top string index
 uint32_t    vmTopString     (Process* proc);
 
-void        vmPushInstruction   (VM* vm, uint32_t opcode);
+/// Return: false if the code segment is full (insOF is set on proc)
+bool        vmPushInstruction   (Process* proc, uint32_t opcode);
 void        vmPopInstruction(VM* vm);
 void        vmPushCompilerInstruction   (VM* vm, uint32_t opcode);
+/// push a number literal, values of 2^31 and above take a few instructions
+void        vmPushCompilerLiteral       (VM* vm, uint32_t value);
+/// push a function index as a literal, modules relocate it
+void        vmPushCompilerReference     (VM* vm, uint32_t funcId);
 void        vmPopCompilerInstruction    (VM* vm);
 
 
 Stream*     vmStreamOpenFile(VM* vm, const char* name, STREAM_MODE mode);
 Stream*     vmStreamFromFile(VM* vm, FILE* f, STREAM_MODE mode);
+Stream*     vmStreamFromMemory(VM* vm, const char* str, uint32_t size);
 Stream*     vmStreamMemory  (VM* vm, uint32_t maxSize);
 void        vmStreamPush    (VM* vm, Stream* strm);
 void        vmStreamPop     (VM* vm);
@@ -277,14 +552,104 @@ uint32_t    vmStreamPos     (VM* vm, Stream* strm);
 void        vmStreamSetPos  (VM* vm, Stream* strm, uint32_t pos);
 
 //
-// start looking for the function from the last added entry
+// start looking for the function from the last added entry, lambdas are not in
+// the dictionary
 // Return: 0        -> not found
 //         v != 0   -> function index + 1 (decrement to get the function)
 //
 uint32_t    vmFindFunction          (VM* vm, const char* str);
-uint32_t    vmAllocateInterpFunction(VM* vm, const char* str);
+
+//
+// the name of function fidx, a lambda has none and gets "lambda#<fidx>"
+// written to buf (see and debug output only)
+//
+const char* vmFunctionName          (const VM* vm, uint32_t fidx, char buf[VM_NAME_SIZE]);
+
+//
+// add a function named str, its name goes to the char segment. A NULL str adds
+// an anonymous function (lambda), left out of the dictionary
+// Return: the function index, VM_NO_FUNCTION if the function or char segment is
+//         full (fnOF or chOF is set on proc)
+//
+uint32_t    vmAllocateInterpFunction(Process* proc, const char* str);
+/// Return: the function index, VM_NO_FUNCTION if the function or char segment is full
 uint32_t    vmAddNativeFunction     (VM* vm, const char* str, bool isImmediate, NativeFunction native, uint32_t inVS, uint32_t outVS);
 
+/// Return: false if the code segment cannot hold count more instructions (insOF is set in flags)
+bool        vmReserveInstructions   (VM* vm, uint32_t count, ExceptFlags* flags);
+
+//
+// note that the instruction at insOffset is a function literal (lambda or word
+// address), offsets are pushed in code order
+// Return: false if the relocation segment is full
+//
+bool        vmPushRelocation        (VM* vm, uint32_t insOffset);
+
+/// Return: the index of the first relocation at or after insOffset
+uint32_t    vmFirstRelocation       (const VM* vm, uint32_t insOffset);
+
+//
+// set the segment counts after the segments were filled in place (image load),
+// the dictionary is rebuilt from the function segment
+//
+void        vmSetSegmentCounts      (VM* vm, uint32_t funcCount, uint32_t insCount, uint32_t charCount, uint32_t relocCount);
+
+//
+// save the function, code and char segments to path, natives are saved by name.
+// The code of a compact image is encoded, it is smaller but decoded on load
+// instead of mapped
+// Return: false if the image cannot be written or a function is being compiled
+//
+bool        vmImageSave             (VM* vm, const char* path, bool isCompact);
+
+//
+// replace the function, code and char segments of vm by the image at path, the
+// code and chars are mapped from the file. Natives are bound by name to those
+// of vm, no process may be running interpreted code meanwhile
+// Return: false if the image is invalid or names a native vm does not have
+//
+bool        vmImageLoad             (VM* vm, const char* path);
+
+//
+// save an image holding the natives and the words reachable from the rootCount
+// roots only, through calls and function literals. The functions are renumbered
+// and the code and chars compacted
+// Return: false if the image cannot be written or a function is being compiled
+//
+bool        vmImageShake            (VM* vm, const char* path, const uint32_t* roots, uint32_t rootCount, bool isCompact);
+
+/// Return: the number of opcodes, they are the first functions of every VM
+uint32_t    vmOpcodeCount           ();
+
+/// Return: false if the file cannot be read
+bool        vmModuleHash            (const char* path, uint64_t* hash);
+
+//
+// define the words of the module at path and link its external calls by name.
+// The module stays mapped, the code of a word is only copied and linked when it
+// is first fetched (FT_LAZY)
+// Return: false if the module is missing, was built from another source (hash)
+//         or for other opcodes, or references a word the VM lacks. The VM is
+//         left untouched then
+//
+bool        vmModuleLoad            (Process* proc, const char* path, uint64_t sourceHash);
+
+//
+// copy and link the code of the lazy function fidx, a no-op if another worker
+// was first. A corrupt function gets an empty body
+// Return: false if the code segment is full (insOF is set in flags)
+//
+bool        vmModuleMaterialize     (VM* vm, uint32_t fidx, ExceptFlags* flags);
+
+/// unmap the modules, the functions still lazy must not be fetched anymore
+void        vmModuleReleaseAll      (VM* vm);
+
+//
+// write the words recorded while loading sourceName as a module at path
+// Return: false if the module cannot be written or is too large for the format
+//
+bool        vmModuleSave            (VM* vm, const ModuleRecorder* rec, const char* path, const char* sourceName, uint64_t sourceHash);
+
 typedef enum {
 	CS_NO_ERROR,
 	CS_ERROR,
@@ -301,6 +666,16 @@ void        vmFetch         (Process* proc);
 void        vmExecute       (Process* proc);
 void        vmNext          (Process* proc);
 
+//
+// run the process until it leaves the return stack at rsBase or raises a flag
+// Return: true     -> the process returned to rsBase (or the vm is quitting)
+//         false    -> the process was interrupted, check exceptFlags (yF: descheduled)
+//
+bool        vmRunSlice      (Process* proc, uint32_t rsBase);
+
+/// set the number of reductions (calls, tail calls, conds) per time slice
+void        vmSetReductionBudget(Process* proc, uint32_t budget);
+
 void        vmReadEvalPrintLoop (Process* proc);
 void        vmLoad          (Process* proc, const char* stream);
 
@@ -309,22 +684,98 @@ Process*    vmProcessList   (VM* vm);
 
 typedef struct {
     uint32_t    maxProcCount;           // max processor count
-	uint32_t    maxFunctionCount;       // max function count
-	uint32_t    maxInstructionCount;    // max instruction count
-	uint32_t    maxCharSegmentSize;     // max const char segment size
+	uint32_t    maxFunctionCount;       // function count hard limit (0: VM_MAX_FUNCTIONS)
+	uint32_t    maxInstructionCount;    // instruction count hard limit (0: VM_MAX_INSTRUCTIONS)
+	uint32_t    maxCharSegmentSize;     // const char segment hard limit (0: VM_MAX_CHARS)
 
 	uint32_t    maxFileCount;           // maximum file count (file stack)
 
 	// compiler section
 	uint32_t    maxCFCount;             // maximum compiler function count
 	uint32_t    maxCISCount;            // maximum compiler instruction count
+
+	uint32_t    workerCount;            // scheduler worker threads
+
+	bool        reportLeaks;            // print the memory still accounted on vmRelease (MEM_STATS builds)
+	bool        hugeCodePages;          // ask for transparent huge pages on the code segment
 } VMParameters;
 
 VM*         vmNew       (const VMParameters* params);
+/// Return: size bytes of zeroed address space, pages are backed when first touched (NULL on failure)
+void*       vmReserve   (size_t size);
+void        vmUnreserve (void* addr, size_t size);
+
+/// Return: NULL if the stacks cannot be mapped or guarded (vm.max_map_count reached)
 Process*    vmNewProcess(VM* vm, ProcPtr _this_, ProcPtr parent, ProcPtr next, uint32_t maxValueCount, uint32_t maxLocalCount, uint32_t maxReturnCount, uint32_t maxCharCount, uint32_t maxStringCount);
 void        vmReleaseProcess    (Process* proc);
+
+/// give back the stack pages far above the stack tops, they are reopened on demand
+void        vmTrimStacks        (Process* proc);
+
+/// switch back to the process stacks from the generators running, if any (abort)
+void        vmGeneratorUnwind   (Process* proc);
 void        vmRelease   (VM* vm);
 
+////////////////////////////////////////////////////////////////////////////////
+// Scheduler
+////////////////////////////////////////////////////////////////////////////////
+
+//
+// workers always drain the highest priority lane first, except every
+// SCHED_AGING_PERIOD picks where a lower lane goes first (rotating between the
+// lower lanes) so that low priority processes always make progress
+//
+#define SCHED_AGING_PERIOD          8
+#define SCHED_TICK_NS               1000000     // timer resolution
+
+void        vmSchedulerStart(VM* vm, uint32_t workerCount);
+void        vmSchedulerStop (VM* vm);
+
+/// make the process runnable
+void        vmSchedule      (Process* proc);
+
+//
+// spawn a process running the interpreted function `lambda`, stack sizes are
+// inherited from the parent
+// Return: NULL     -> no free process slot, or lambda is not an interpreted function
+//
+Process*    vmSpawn         (VM* vm, ProcPtr parent, uint32_t lambda, uint32_t mailboxCap, ProcPriority priority);
+
+/// make a waiting process runnable again (spurious wake ups are harmless)
+void        vmWake          (Process* proc);
+
+//
+// called by a native that cannot complete yet: the process is parked at the end
+// of its slice and the native is executed again once it is woken up, the native
+// must put its arguments back on the value stack before calling this
+//
+void        vmWaitAndRetry  (Process* proc);
+
+/// yield point of processes not run by the scheduler (the repl), blocks if a wait was requested
+void        vmYieldUnscheduled  (Process* proc);
+
+/// scheduler ticks (ms) since the vm started
+uint64_t    vmTicks         (VM* vm);
+
+/// arm a timer firing after delay ms and then every period ms (0: one shot), the callback runs on a worker with the timer lock held
+void        vmTimerStart    (VM* vm, Timer* timer, uint32_t delay, uint32_t period, TimerCallback callback, void* data);
+void        vmTimerCancel   (VM* vm, Timer* timer);
+
+//
+// sender is NULL when not sent from a process (timers), such messages always go
+// through the MPMC mailbox
+// Return: true     -> the message was queued in the mailbox of pid
+//         false    -> pid is gone, has no mailbox or its mailbox is full
+//
+bool        vmSend          (VM* vm, Process* sender, uint64_t pid, void* addr, uint32_t size);
+
+/// send a frozen buffer by reference, the receiver gets (buf, size) and owns one reference
+/// Return: same as vmSend, false as well if buf is NULL or not frozen
+bool        vmSendBuffer    (VM* vm, Process* sender, uint64_t pid, Buffer* buf);
+
+/// Return: false if the mailbox is empty
+bool        vmReceive       (Process* proc, Message* msg);
+
 
 
 
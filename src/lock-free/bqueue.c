@@ -28,10 +28,7 @@ BoundedQueue*
 BoundedQueue_init(BoundedQueue* bq, uint32_t cap) {
     memset(bq, 0, sizeof(BoundedQueue));
     bq->cap             = cap;
-    bq->elements        = calloc(cap, sizeof(Element));
-    for( uint32_t i = 0; i < cap; ++i ) {
-        atomic_store_explicit(&bq->elements[i].seq, i, memory_order_release);
-    }
+    bq->elements        = calloc(cap, sizeof(Element));  // all slots free, see loadSeq
     return bq;
 }
 
@@ -40,6 +37,24 @@ BoundedQueue_release(BoundedQueue* bq) {
     free(bq->elements);
 }
 
+//
+// a slot stores its sequence minus its index, so zeroed memory already is an
+// empty queue: large queues are never touched beyond the slots they use
+//
+static inline
+uint32_t
+loadSeq(BoundedQueue* bq, uint32_t pos) {
+    uint32_t    i   = pos % bq->cap;
+    return (uint32_t)atomic_load_explicit(&bq->elements[i].seq, memory_order_acquire) + i;
+}
+
+static inline
+void
+storeSeq(BoundedQueue* bq, uint32_t pos, uint32_t seq) {
+    uint32_t    i   = pos % bq->cap;
+    atomic_store_explicit(&bq->elements[i].seq, (uint32_t)(seq - i), memory_order_release);
+}
+
 bool
 BoundedQueue_push(BoundedQueue* bq, void* data) {
     Element*    el  = NULL;
@@ -47,16 +62,17 @@ BoundedQueue_push(BoundedQueue* bq, void* data) {
 
     while(true) {
         el  = &bq->elements[last % bq->cap];
-        uint32_t seq  = atomic_load_explicit(&el->seq, memory_order_acquire);
+        uint32_t seq  = loadSeq(bq, last);
         int32_t diff  = (int32_t)(seq) - (int32_t)(last);
         if( diff == 0 && atomic_compare_exchange_weak(&bq->last, &last, last + 1) ) {
             break;
-        } else if( diff < 0 ) { return false; }
+        } else if( diff < 0 ) { LF_COUNT(LF_BQ_FULL); return false; }
+        LF_COUNT(diff == 0 ? LF_BQ_CAS_FAIL : LF_BQ_RETRY);
         last    = atomic_load_explicit(&bq->last, memory_order_acquire);
     }
 
     atomic_store_explicit(&el->data, data, memory_order_release);
-    atomic_store_explicit(&el->seq, last + 1, memory_order_release);
+    storeSeq(bq, last, last + 1);
     return true;
 }
 
@@ -67,16 +83,85 @@ BoundedQueue_pop(BoundedQueue* bq) {
     uint32_t    first   = atomic_load_explicit(&bq->first, memory_order_acquire);
     while(true) {
         el  = &bq->elements[first % bq->cap];
-        uint32_t seq  = atomic_load_explicit(&el->seq, memory_order_acquire);
+        uint32_t seq  = loadSeq(bq, first);
         int32_t diff  = (int32_t)(seq) - (int32_t)((first + 1));
         if( diff == 0 && atomic_compare_exchange_weak(&bq->first, &first, first + 1) ) {
             break;
-        } else if( diff < 0 ) { return NULL; }
+        } else if( diff < 0 ) { LF_COUNT(LF_BQ_EMPTY); return NULL; }
+        LF_COUNT(diff == 0 ? LF_BQ_CAS_FAIL : LF_BQ_RETRY);
 
         first  = atomic_load_explicit(&bq->first, memory_order_acquire);
     }
 
     data    = atomic_load_explicit(&el->data, memory_order_acquire);
-    atomic_store_explicit(&el->seq, first + bq->cap, memory_order_release);
+    storeSeq(bq, first, first + bq->cap);
     return data;
 }
+
+uint32_t
+BoundedQueue_pushN(BoundedQueue* bq, void* const* data, uint32_t count) {
+    uint32_t    last    = atomic_load_explicit(&bq->last, memory_order_acquire);
+    uint32_t    n       = 0;
+
+    count   = count < bq->cap ? count : bq->cap;
+    while( count ) {
+        // count the free slots from last on, a slot stays free until its
+        // position is claimed through last
+        n   = 0;
+        int32_t diff    = 0;
+        while( n < count ) {
+            uint32_t    seq = loadSeq(bq, last + n);
+            diff    = (int32_t)(seq) - (int32_t)(last + n);
+            if( diff != 0 ) {
+                break;
+            }
+            ++n;
+        }
+
+        if( n && atomic_compare_exchange_weak(&bq->last, &last, last + n) ) {
+            break;
+        } else if( n == 0 && diff < 0 ) { LF_COUNT(LF_BQ_FULL); return 0; }
+        LF_COUNT(n ? LF_BQ_CAS_FAIL : LF_BQ_RETRY);
+        last    = atomic_load_explicit(&bq->last, memory_order_acquire);
+    }
+
+    for( uint32_t i = 0; i < n; ++i ) {
+        Element*    el  = &bq->elements[(last + i) % bq->cap];
+        atomic_store_explicit(&el->data, data[i], memory_order_release);
+        storeSeq(bq, last + i, last + i + 1);
+    }
+    return n;
+}
+
+uint32_t
+BoundedQueue_popN(BoundedQueue* bq, void** data, uint32_t count) {
+    uint32_t    first   = atomic_load_explicit(&bq->first, memory_order_acquire);
+    uint32_t    n       = 0;
+
+    count   = count < bq->cap ? count : bq->cap;
+    while( count ) {
+        n   = 0;
+        int32_t diff    = 0;
+        while( n < count ) {
+            uint32_t    seq = loadSeq(bq, first + n);
+            diff    = (int32_t)(seq) - (int32_t)(first + n + 1);
+            if( diff != 0 ) {
+                break;
+            }
+            ++n;
+        }
+
+        if( n && atomic_compare_exchange_weak(&bq->first, &first, first + n) ) {
+            break;
+        } else if( n == 0 && diff < 0 ) { LF_COUNT(LF_BQ_EMPTY); return 0; }
+        LF_COUNT(n ? LF_BQ_CAS_FAIL : LF_BQ_RETRY);
+        first   = atomic_load_explicit(&bq->first, memory_order_acquire);
+    }
+
+    for( uint32_t i = 0; i < n; ++i ) {
+        Element*    el  = &bq->elements[(first + i) % bq->cap];
+        data[i] = atomic_load_explicit(&el->data, memory_order_acquire);
+        storeSeq(bq, first + i, first + i + bq->cap);
+    }
+    return n;
+}
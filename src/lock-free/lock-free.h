@@ -1,3 +1,5 @@
+#pragma once
+
 /*
 ** Copyright (c) 2017-2018 Wael El Oraiby.
 **
@@ -20,16 +22,73 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#define LF_CACHE_LINE   64
+
+////////////////////////////////////////////////////////////////////////////////
+// Contention Counters
+////////////////////////////////////////////////////////////////////////////////
+//
+// compiled in with LF_STATS only, LF_COUNT expands to nothing otherwise. Each
+// thread counts in its own shard, LfStats_collect sums the shards on demand
+// (shards of exited threads are kept so nothing is lost).
+//
+typedef enum {
+    LF_BQ_CAS_FAIL,     // BoundedQueue: lost a CAS on first/last
+    LF_BQ_RETRY,        // BoundedQueue: slot taken by someone else, index reloaded
+    LF_BQ_FULL,         // BoundedQueue: push found the queue full
+    LF_BQ_EMPTY,        // BoundedQueue: pop found the queue empty
+    LF_Q_CAS_FAIL,      // Queue: lost a CAS on first/last/next
+    LF_Q_RETRY,         // Queue: snapshot changed under us, or helped a lagging last
+    LF_Q_EMPTY,         // Queue: pop found the queue empty
+    LF_Q_SPIN,          // Queue: hazard pointer publish loop iterations
+    LF_STAT_COUNT
+} LfStat;
+
+typedef struct {
+    uint64_t    counts[LF_STAT_COUNT];
+} LfStats;
+
+extern const char*  LfStat_names[LF_STAT_COUNT];
+
+//
+// sum the counters of all threads
+// Return: false if the counters are compiled out (stats is zeroed)
+//
+bool            LfStats_collect(LfStats* stats);
+void            LfStats_reset();
+
+#ifdef LF_STATS
+void            LfStats_add(LfStat stat, uint64_t n);
+#   define LF_COUNT(stat)   LfStats_add((stat), 1)
+#else
+#   define LF_COUNT(stat)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Bounded Queue
+////////////////////////////////////////////////////////////////////////////////
+//
+// first and last are written by consumers and producers respectively, each sits
+// on its own cache line away from the read only cap/elements. Define
+// LF_PAD_SLOTS to give every element a full cache line as well (4x the memory,
+// neighbouring slots no longer contend).
+//
 typedef struct {
     uint64_t    seq;
     void*       data;
+#ifdef LF_PAD_SLOTS
+    char        _pad[LF_CACHE_LINE - sizeof(uint64_t) - sizeof(void*)];
+#endif
 } Element;
 
 typedef struct {
-    uint32_t    first;
-    uint32_t    last;
     uint32_t    cap;
     Element*    elements;
+    char        _pad0[LF_CACHE_LINE - sizeof(uint32_t) - sizeof(Element*)];
+    uint32_t    first;
+    char        _pad1[LF_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t    last;
+    char        _pad2[LF_CACHE_LINE - sizeof(uint32_t)];
 } BoundedQueue;
 
 BoundedQueue*   BoundedQueue_init(BoundedQueue* bq, uint32_t cap);
@@ -37,10 +96,30 @@ void            BoundedQueue_release(BoundedQueue* bq);
 bool            BoundedQueue_push(BoundedQueue* bq, void* data);
 void*           BoundedQueue_pop(BoundedQueue* bq);
 
+//
+// push up to count elements claiming their slots with a single CAS, the
+// elements keep their order
+// Return: the number of elements pushed, 0 if the queue is full
+//
+uint32_t        BoundedQueue_pushN(BoundedQueue* bq, void* const* data, uint32_t count);
+
+//
+// pop up to count elements claiming their slots with a single CAS
+// Return: the number of elements popped, 0 if the queue is empty
+//
+uint32_t        BoundedQueue_popN(BoundedQueue* bq, void** data, uint32_t count);
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Unbounded Queue
 ////////////////////////////////////////////////////////////////////////////////
+//
+// Michael-Scott queue: the payload is written before the node is linked, so a
+// visible `next` means its data is ready. Popped nodes are retired through
+// hazard pointers and recycled through per-thread node caches that exchange
+// batches of QUEUE_NODE_BATCH nodes with a global pool, the queue does not
+// allocate once the caches are warm.
+//
 typedef struct Node Node;
 
 struct Node {
@@ -53,7 +132,61 @@ typedef struct {
     Node*   last;
 } Queue;
 
+#define QUEUE_NODE_BATCH        64      // nodes moved at once between a thread cache and the pool
+#define QUEUE_NODE_POOL_BATCHES 1024    // batches kept in the global pool
+
 Queue*      Queue_init(Queue* q);
 void        Queue_release(Queue* q);
 void        Queue_push(Queue* q, void *data);
+
+/// Return: false if the queue is empty, NULL payloads are allowed
+bool        Queue_tryPop(Queue* q, void** data);
+
+/// Return: NULL if the queue is empty
 void*       Queue_pop(Queue* q);
+
+/// Return: bytes of nodes allocated by all the queues (in use, cached or pooled)
+size_t      Queue_nodeBytes();
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Single Producer Single Consumer Queue
+////////////////////////////////////////////////////////////////////////////////
+//
+// wait-free ring for exactly one producer thread and one consumer thread at a
+// time, no CAS: each side owns its index and keeps a cached copy of the other
+// one, refreshed only when the ring looks full (or empty). The capacity is
+// rounded up to a power of 2.
+//
+typedef struct {
+    uint32_t    mask;
+    void**      slots;
+    char        _pad0[LF_CACHE_LINE - sizeof(uint32_t) - sizeof(void**)];
+    uint32_t    head;           // next slot to pop, written by the consumer
+    uint32_t    cachedTail;     // consumer's view of tail
+    char        _pad1[LF_CACHE_LINE - 2 * sizeof(uint32_t)];
+    uint32_t    tail;           // next slot to push, written by the producer
+    uint32_t    cachedHead;     // producer's view of head
+    char        _pad2[LF_CACHE_LINE - 2 * sizeof(uint32_t)];
+} SpscQueue;
+
+SpscQueue*      SpscQueue_init(SpscQueue* q, uint32_t cap);
+void            SpscQueue_release(SpscQueue* q);
+
+/// Return: false if the queue is full
+bool            SpscQueue_push(SpscQueue* q, void* data);
+
+/// Return: NULL if the queue is empty
+void*           SpscQueue_pop(SpscQueue* q);
+
+//
+// push up to count elements, published at once
+// Return: the number of elements pushed
+//
+uint32_t        SpscQueue_pushN(SpscQueue* q, void* const* data, uint32_t count);
+
+//
+// pop up to count elements
+// Return: the number of elements popped
+//
+uint32_t        SpscQueue_popN(SpscQueue* q, void** data, uint32_t count);
@@ -0,0 +1,104 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lock-free.h"
+
+SpscQueue*
+SpscQueue_init(SpscQueue* q, uint32_t cap) {
+    uint32_t    size    = 1;
+    while( size < cap ) {
+        size <<= 1;
+    }
+
+    memset(q, 0, sizeof(SpscQueue));
+    q->mask     = size - 1;
+    q->slots    = calloc(size, sizeof(void*));
+    return q;
+}
+
+void
+SpscQueue_release(SpscQueue* q) {
+    free(q->slots);
+    q->slots    = NULL;
+}
+
+// room left for the producer, head is only reloaded when the cached one says full
+static inline
+uint32_t
+freeSlots(SpscQueue* q, uint32_t tail, uint32_t wanted) {
+    uint32_t    room    = q->mask + 1 - (tail - q->cachedHead);
+    if( room < wanted ) {
+        q->cachedHead   = atomic_load_explicit(&q->head, memory_order_acquire);
+        room    = q->mask + 1 - (tail - q->cachedHead);
+    }
+    return room;
+}
+
+// elements ready for the consumer, same idea with tail
+static inline
+uint32_t
+usedSlots(SpscQueue* q, uint32_t head, uint32_t wanted) {
+    uint32_t    used    = q->cachedTail - head;
+    if( used < wanted ) {
+        q->cachedTail   = atomic_load_explicit(&q->tail, memory_order_acquire);
+        used    = q->cachedTail - head;
+    }
+    return used;
+}
+
+bool
+SpscQueue_push(SpscQueue* q, void* data) {
+    return SpscQueue_pushN(q, &data, 1) == 1;
+}
+
+void*
+SpscQueue_pop(SpscQueue* q) {
+    void*   data    = NULL;
+    return SpscQueue_popN(q, &data, 1) ? data : NULL;
+}
+
+uint32_t
+SpscQueue_pushN(SpscQueue* q, void* const* data, uint32_t count) {
+    uint32_t    tail    = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    uint32_t    room    = freeSlots(q, tail, count);
+    count   = count < room ? count : room;
+
+    for( uint32_t i = 0; i < count; ++i ) {
+        q->slots[(tail + i) & q->mask]  = data[i];
+    }
+    atomic_store_explicit(&q->tail, tail + count, memory_order_release);
+    return count;
+}
+
+uint32_t
+SpscQueue_popN(SpscQueue* q, void** data, uint32_t count) {
+    uint32_t    head    = atomic_load_explicit(&q->head, memory_order_relaxed);
+    uint32_t    used    = usedSlots(q, head, count);
+    count   = count < used ? count : used;
+
+    for( uint32_t i = 0; i < count; ++i ) {
+        data[i] = q->slots[(head + i) & q->mask];
+    }
+    atomic_store_explicit(&q->head, head + count, memory_order_release);
+    return count;
+}
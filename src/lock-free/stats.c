@@ -0,0 +1,100 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lock-free.h"
+
+const char* LfStat_names[LF_STAT_COUNT] = {
+    [LF_BQ_CAS_FAIL]    = "bqueue.cas.fail",
+    [LF_BQ_RETRY]       = "bqueue.retry",
+    [LF_BQ_FULL]        = "bqueue.full",
+    [LF_BQ_EMPTY]       = "bqueue.empty",
+    [LF_Q_CAS_FAIL]     = "queue.cas.fail",
+    [LF_Q_RETRY]        = "queue.retry",
+    [LF_Q_EMPTY]        = "queue.empty",
+    [LF_Q_SPIN]         = "queue.spin",
+};
+
+#ifdef LF_STATS
+
+typedef struct StatShard StatShard;
+
+// one per thread, only its owner writes it
+struct StatShard {
+    uint64_t    counts[LF_STAT_COUNT];
+    StatShard*  next;
+};
+
+static StatShard*               shards      = NULL;
+static _Thread_local StatShard* localShard  = NULL;
+
+void
+LfStats_add(LfStat stat, uint64_t n) {
+    StatShard*  shard   = localShard;
+    if( shard == NULL ) {
+        shard   = calloc(1, sizeof(StatShard));
+        StatShard*  head    = atomic_load(&shards);
+        do {
+            shard->next = head;
+        } while( !atomic_compare_exchange_weak(&shards, &head, shard) );
+        localShard  = shard;
+    }
+
+    // single writer, no read-modify-write needed
+    uint64_t    count   = atomic_load_explicit(&shard->counts[stat], memory_order_relaxed);
+    atomic_store_explicit(&shard->counts[stat], count + n, memory_order_relaxed);
+}
+
+bool
+LfStats_collect(LfStats* stats) {
+    memset(stats, 0, sizeof(LfStats));
+    for( StatShard* shard = atomic_load(&shards); shard; shard = shard->next ) {
+        for( uint32_t s = 0; s < LF_STAT_COUNT; ++s ) {
+            stats->counts[s]    += atomic_load_explicit(&shard->counts[s], memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+void
+LfStats_reset() {
+    // racy against concurrent increments by design, a count may survive
+    for( StatShard* shard = atomic_load(&shards); shard; shard = shard->next ) {
+        for( uint32_t s = 0; s < LF_STAT_COUNT; ++s ) {
+            atomic_store_explicit(&shard->counts[s], 0, memory_order_relaxed);
+        }
+    }
+}
+
+#else
+
+bool
+LfStats_collect(LfStats* stats) {
+    memset(stats, 0, sizeof(LfStats));
+    return false;
+}
+
+void
+LfStats_reset() {
+}
+
+#endif
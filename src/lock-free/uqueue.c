@@ -22,56 +22,343 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "lock-free.h"
 
+////////////////////////////////////////////////////////////////////////////////
+// Hazard pointers and node caches
+////////////////////////////////////////////////////////////////////////////////
+//
+// every thread touching a queue owns a record holding its hazard pointers, the
+// nodes it retired and its cache of free nodes. Records are never freed, a
+// record left by an exited thread is adopted by the next new thread.
+//
+
+#define HAZARD_COUNT    2
+
+typedef struct HazardRecord HazardRecord;
+
+struct HazardRecord {
+    Node*           hazards[HAZARD_COUNT];
+    HazardRecord*   next;           // record list
+    atomic_bool     isActive;       // owned by a live thread
+
+    Node**          retired;        // popped nodes, possibly still read by others,
+    uint32_t        retiredCount;   // their next links must stay untouched until
+    uint32_t        retiredCap;     // nobody protects them anymore
+
+    Node*           cache;          // free nodes
+    uint32_t        cacheCount;
+
+    Node**          scratch;        // hazard snapshot used while scanning
+    uint32_t        scratchCap;
+};
+
+static HazardRecord*            hazardRecords   = NULL;
+static atomic_uint              hazardRecordCount;
+static BoundedQueue             nodePool;       // chains of QUEUE_NODE_BATCH free nodes
+static atomic_size_t            nodeBytes;      // nodes currently malloc'd
+static pthread_once_t           globalsOnce     = PTHREAD_ONCE_INIT;
+static pthread_key_t            recordKey;
+static _Thread_local HazardRecord*  localRecord = NULL;
+
+static
+void
+freeChain(Node* n) {
+    while( n ) {
+        Node*   next    = n->next;
+        free(n);
+        atomic_fetch_sub_explicit(&nodeBytes, sizeof(Node), memory_order_relaxed);
+        n   = next;
+    }
+}
+
+// give QUEUE_NODE_BATCH nodes of the cache back to the pool
+static
+void
+releaseBatch(HazardRecord* rec) {
+    Node*   batch   = rec->cache;
+    Node*   tail    = batch;
+    for( uint32_t i = 1; i < QUEUE_NODE_BATCH; ++i ) {
+        tail    = tail->next;
+    }
+    rec->cache      = tail->next;
+    rec->cacheCount -= QUEUE_NODE_BATCH;
+    tail->next      = NULL;
+
+    if( !BoundedQueue_push(&nodePool, batch) ) {
+        freeChain(batch);
+    }
+}
+
+static
+void
+onThreadExit(void* arg) {
+    HazardRecord*   rec = arg;
+    while( rec->cacheCount >= QUEUE_NODE_BATCH ) {
+        releaseBatch(rec);
+    }
+    freeChain(rec->cache);
+    rec->cache      = NULL;
+    rec->cacheCount = 0;
+
+    for( uint32_t h = 0; h < HAZARD_COUNT; ++h ) {
+        atomic_store(&rec->hazards[h], NULL);
+    }
+    // the retired nodes stay with the record until it is adopted
+    atomic_store(&rec->isActive, false);
+}
+
+static
+void
+initGlobals() {
+    BoundedQueue_init(&nodePool, QUEUE_NODE_POOL_BATCHES);
+    pthread_key_create(&recordKey, onThreadExit);
+}
+
+static
+HazardRecord*
+hazardRecord() {
+    HazardRecord*   rec     = localRecord;
+    if( rec ) {
+        return rec;
+    }
+
+    pthread_once(&globalsOnce, initGlobals);
+
+    for( rec = atomic_load(&hazardRecords); rec; rec = rec->next ) {
+        bool    isActive    = false;
+        if( atomic_compare_exchange_strong(&rec->isActive, &isActive, true) ) {
+            break;
+        }
+    }
+
+    if( rec == NULL ) {
+        rec = calloc(1, sizeof(HazardRecord));
+        atomic_store(&rec->isActive, true);
+        HazardRecord*   head    = atomic_load(&hazardRecords);
+        do {
+            rec->next   = head;
+        } while( !atomic_compare_exchange_weak(&hazardRecords, &head, rec) );
+        atomic_fetch_add(&hazardRecordCount, 1);
+    }
+
+    localRecord = rec;
+    pthread_setspecific(recordKey, rec);
+    return rec;
+}
+
+//
+// publish a hazard on *src, loop until the published value is still current
+// (the node cannot be reclaimed from then on)
+//
+static inline
+Node*
+protect(HazardRecord* rec, uint32_t h, Node** src) {
+    Node*   n   = atomic_load(src);
+    while( true ) {
+        atomic_store(&rec->hazards[h], n);
+        Node*   again   = atomic_load(src);
+        if( again == n ) {
+            return n;
+        }
+        LF_COUNT(LF_Q_SPIN);
+        n   = again;
+    }
+}
+
+static inline
+void
+clearHazards(HazardRecord* rec) {
+    for( uint32_t h = 0; h < HAZARD_COUNT; ++h ) {
+        atomic_store_explicit(&rec->hazards[h], NULL, memory_order_release);
+    }
+}
+
+static
+Node*
+allocNode(HazardRecord* rec) {
+    if( rec->cache == NULL ) {
+        Node*   batch   = BoundedQueue_pop(&nodePool);
+        if( batch == NULL ) {
+            atomic_fetch_add_explicit(&nodeBytes, sizeof(Node), memory_order_relaxed);
+            return malloc(sizeof(Node));
+        }
+        rec->cache      = batch;
+        rec->cacheCount = QUEUE_NODE_BATCH;
+    }
+
+    Node*   n   = rec->cache;
+    rec->cache  = n->next;
+    --rec->cacheCount;
+    return n;
+}
+
+static
+void
+cacheNode(HazardRecord* rec, Node* n) {
+    n->next     = rec->cache;
+    rec->cache  = n;
+    ++rec->cacheCount;
+    if( rec->cacheCount >= 2 * QUEUE_NODE_BATCH ) {
+        releaseBatch(rec);
+    }
+}
+
+// move the retired nodes nobody protects anymore to the cache
+static
+void
+scanRetired(HazardRecord* rec) {
+    // records are only ever added at the head, a record added after this point
+    // cannot validate a hazard on an already retired node
+    HazardRecord*   head        = atomic_load(&hazardRecords);
+    uint32_t        hazardCount = 0;
+    uint32_t        cap         = 0;
+
+    for( HazardRecord* r = head; r; r = r->next ) {
+        cap += HAZARD_COUNT;
+    }
+    if( rec->scratchCap < cap ) {
+        free(rec->scratch);
+        rec->scratch    = malloc(cap * 2 * sizeof(Node*));
+        rec->scratchCap = cap * 2;
+    }
+
+    for( HazardRecord* r = head; r; r = r->next ) {
+        for( uint32_t h = 0; h < HAZARD_COUNT; ++h ) {
+            Node*   n   = atomic_load(&r->hazards[h]);
+            if( n ) {
+                rec->scratch[hazardCount++] = n;
+            }
+        }
+    }
+
+    uint32_t    kept    = 0;
+    for( uint32_t i = 0; i < rec->retiredCount; ++i ) {
+        Node*   n           = rec->retired[i];
+        bool    isHazard    = false;
+        for( uint32_t h = 0; h < hazardCount && !isHazard; ++h ) {
+            isHazard    = rec->scratch[h] == n;
+        }
+
+        if( isHazard ) {
+            rec->retired[kept++]    = n;
+        } else {
+            cacheNode(rec, n);
+        }
+    }
+    rec->retiredCount   = kept;
+}
+
+static
+void
+retireNode(HazardRecord* rec, Node* n) {
+    // a pusher holding a stale last may still try to link behind n, keep its
+    // next as is so that the CAS fails
+    if( rec->retiredCount == rec->retiredCap ) {
+        rec->retiredCap = rec->retiredCap ? 2 * rec->retiredCap : 2 * QUEUE_NODE_BATCH;
+        rec->retired    = realloc(rec->retired, rec->retiredCap * sizeof(Node*));
+    }
+    rec->retired[rec->retiredCount++]   = n;
+
+    if( rec->retiredCount >= QUEUE_NODE_BATCH + 2 * HAZARD_COUNT * atomic_load(&hazardRecordCount) ) {
+        scanRetired(rec);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue
+////////////////////////////////////////////////////////////////////////////////
+
 Queue*
 Queue_init(Queue* q) {
     memset(q, 0, sizeof(Queue));
-    q->first    = q->last   = calloc(1, sizeof(Node));
+    Node*   dummy   = allocNode(hazardRecord());
+    dummy->data     = NULL;
+    dummy->next     = NULL;
+    q->first    = q->last   = dummy;
     return q;
 }
 
 void
 Queue_release(Queue* q) {
-	Node*   tmp     = NULL;
-	Node*   curr    = q->first;
-	while( curr ) {
-		tmp     = curr->next;
-		free(curr);
-		curr    = tmp;
-	}
+    freeChain(q->first);
+    q->first    = q->last   = NULL;
 }
 
 void
 Queue_push(Queue* q, void *data) {
-	Node*   n       = calloc(1, sizeof(Node));
-    Node*   last    = atomic_load_explicit(&q->last, memory_order_acquire);
-    while( !atomic_compare_exchange_weak(&q->last, &last, n) );
-    atomic_store_explicit(&last->next, n, memory_order_release);
-    atomic_store_explicit(&last->data, data, memory_order_release);
+    HazardRecord*   rec     = hazardRecord();
+    Node*           n       = allocNode(rec);
+    n->data = data;
+    n->next = NULL;
+
+    while( true ) {
+        Node*   last    = protect(rec, 0, &q->last);
+        Node*   next    = atomic_load_explicit(&last->next, memory_order_acquire);
+        if( next != NULL ) {
+            // the last pointer lags behind, help it
+            LF_COUNT(LF_Q_RETRY);
+            atomic_compare_exchange_weak(&q->last, &last, next);
+            continue;
+        }
+
+        if( atomic_compare_exchange_weak(&last->next, &next, n) ) {
+            atomic_compare_exchange_strong(&q->last, &last, n);
+            break;
+        }
+        LF_COUNT(LF_Q_CAS_FAIL);
+    }
+
+    clearHazards(rec);
 }
 
-void*
-Queue_pop(Queue* q) {
-    Node*   first   = NULL;
-    Node*   next    = NULL;
-    void*   data    = NULL;
+bool
+Queue_tryPop(Queue* q, void** data) {
+    HazardRecord*   rec     = hazardRecord();
 
-    do {
-        first   = atomic_load_explicit(&q->first, memory_order_acquire);
-        next    = atomic_load_explicit(&first->next, memory_order_acquire);
-        if( next == NULL ) { return NULL; } // queue is empty, nothing to do, bail!
-    } while( !atomic_compare_exchange_strong(&q->first, &first, next) );
+    while( true ) {
+        Node*   first   = protect(rec, 0, &q->first);
+        Node*   next    = protect(rec, 1, &first->next);
+        if( first != atomic_load(&q->first) ) {
+            LF_COUNT(LF_Q_RETRY);
+            continue;   // next may belong to a recycled node
+        }
 
-    // wait for the data to come in (this will block if the push was preempted but popping from
-    // other threads can continue regardless)
-    do {
-        data    = atomic_load_explicit(&first->data, memory_order_acquire);
-    } while( data == NULL );
+        if( next == NULL ) {
+            LF_COUNT(LF_Q_EMPTY);
+            clearHazards(rec);
+            return false;   // queue is empty, nothing to do, bail!
+        }
 
-    free(first);
+        Node*   last    = atomic_load(&q->last);
+        if( first == last ) {
+            // never let first overtake last
+            LF_COUNT(LF_Q_RETRY);
+            atomic_compare_exchange_weak(&q->last, &last, next);
+            continue;
+        }
 
-    return data;
+        // next becomes the new dummy, its payload was written before it was linked
+        void*   d   = next->data;
+        if( atomic_compare_exchange_weak(&q->first, &first, next) ) {
+            clearHazards(rec);
+            retireNode(rec, first);
+            *data   = d;
+            return true;
+        }
+        LF_COUNT(LF_Q_CAS_FAIL);
+    }
 }
 
+void*
+Queue_pop(Queue* q) {
+    void*   data    = NULL;
+    return Queue_tryPop(q, &data) ? data : NULL;
+}
+
+size_t
+Queue_nodeBytes() {
+    return atomic_load_explicit(&nodeBytes, memory_order_relaxed);
+}
@@ -23,18 +23,27 @@ main(int argc, char* argv[]) {
 
 	VMParameters    params = {
         .maxProcCount           = 16384,    // max process count
-		.maxFunctionCount       = 4096,     // max function count
-		.maxInstructionCount    = 65536,    // max instruction count
-		.maxCharSegmentSize     = 65536,    // max const char segment size
+		.maxFunctionCount       = 0,        // function count hard limit (default)
+		.maxInstructionCount    = 0,        // instruction count hard limit (default)
+		.maxCharSegmentSize     = 0,        // const char segment hard limit (default)
 		.maxFileCount           = 1024,     // maximum file count (file stack)
 		.maxCFCount             = 64,       // maximum compiler function count
 		.maxCISCount            = 65536,    // maximum compiler instruction count
+		.workerCount            = 4,        // scheduler worker threads
+		.reportLeaks            = true,     // memory left on exit (MEM_STATS builds)
 	};
 
 	VM* vm = vmNew(&params);
     Process* proc   = vmNewProcess(vm, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, 1024, 1024, 1024, 2 * 65536, 32769);
 
-	vmLoad(proc, "bootstrap.ncvm");
+	// an image saved with image.save skips compiling the bootstrap
+	if( argc > 1 ) {
+		if( !vmImageLoad(vm, argv[1]) ) {
+			return 1;
+		}
+	} else {
+		vmLoad(proc, "bootstrap.ncvm");
+	}
 
 	vmPushValue(proc, (Value){ .u32 = 1 });
 	vmReadEvalPrintLoop(proc);
@@ -0,0 +1,141 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem-stats.h"
+#include "lock-free/lock-free.h"
+
+const char* MemCategory_names[MEM_CATEGORY_COUNT] = {
+	[MEM_SEGMENTS]  = "segments",
+	[MEM_STACKS]    = "stacks",
+	[MEM_MAP]       = "map",
+	[MEM_REGIONS]   = "regions",
+	[MEM_BUFFERS]   = "buffers",
+	[MEM_MESSAGES]  = "messages",
+	[MEM_QUEUES]    = "queues",
+	[MEM_STREAMS]   = "streams",
+};
+
+#ifdef MEM_STATS
+
+// the last slot of every array counts all categories
+#define SLOT_COUNT      (MEM_CATEGORY_COUNT + 1)
+#define SLOT_TOTAL      MEM_CATEGORY_COUNT
+
+typedef struct StatShard StatShard;
+
+// one per thread, only its owner writes it
+struct StatShard {
+	int64_t     current[SLOT_COUNT];
+	int64_t     unpublished[SLOT_COUNT];    // not added to the shared balance yet
+	uint64_t    allocs[MEM_CATEGORY_COUNT];
+	uint64_t    frees[MEM_CATEGORY_COUNT];
+	StatShard*  next;
+};
+
+static StatShard*               shards      = NULL;
+static _Thread_local StatShard* localShard  = NULL;
+static int64_t                  balance[SLOT_COUNT];    // sum of the published shard balances
+static int64_t                  peaks[SLOT_COUNT];
+
+static inline
+void
+publish(StatShard* shard, uint32_t slot) {
+	int64_t     now     = atomic_fetch_add_explicit(&balance[slot], shard->unpublished[slot], memory_order_relaxed) + shard->unpublished[slot];
+	int64_t     peak    = atomic_load_explicit(&peaks[slot], memory_order_relaxed);
+	while( now > peak && !atomic_compare_exchange_weak_explicit(&peaks[slot], &peak, now, memory_order_relaxed, memory_order_relaxed) ) {
+	}
+	shard->unpublished[slot]    = 0;
+}
+
+static inline
+void
+addTo(StatShard* shard, uint32_t slot, int64_t bytes) {
+	// single writer, no read-modify-write needed
+	int64_t     current = atomic_load_explicit(&shard->current[slot], memory_order_relaxed);
+	atomic_store_explicit(&shard->current[slot], current + bytes, memory_order_relaxed);
+
+	shard->unpublished[slot]    += bytes;
+	if( shard->unpublished[slot] >= MEM_STATS_SLACK || shard->unpublished[slot] <= -MEM_STATS_SLACK ) {
+		publish(shard, slot);
+	}
+}
+
+void
+MemStats_add(MemCategory cat, int64_t bytes) {
+	StatShard*  shard   = localShard;
+	if( shard == NULL ) {
+		shard   = calloc(1, sizeof(StatShard));
+		StatShard*  head    = atomic_load(&shards);
+		do {
+			shard->next = head;
+		} while( !atomic_compare_exchange_weak(&shards, &head, shard) );
+		localShard  = shard;
+	}
+
+	uint64_t*   count   = bytes >= 0 ? &shard->allocs[cat] : &shard->frees[cat];
+	atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+	addTo(shard, cat, bytes);
+	addTo(shard, SLOT_TOTAL, bytes);
+}
+
+bool
+MemStats_collect(MemStats* stats) {
+	int64_t     current[SLOT_COUNT] = { 0 };
+
+	memset(stats, 0, sizeof(MemStats));
+	for( StatShard* shard = atomic_load(&shards); shard; shard = shard->next ) {
+		for( uint32_t s = 0; s < SLOT_COUNT; ++s ) {
+			current[s]  += atomic_load_explicit(&shard->current[s], memory_order_relaxed);
+		}
+		for( uint32_t c = 0; c < MEM_CATEGORY_COUNT; ++c ) {
+			stats->allocs[c]    += atomic_load_explicit(&shard->allocs[c], memory_order_relaxed);
+			stats->frees[c]     += atomic_load_explicit(&shard->frees[c], memory_order_relaxed);
+		}
+	}
+
+	// unbounded queue nodes are pooled inside the queue library
+	int64_t     nodes   = (int64_t)Queue_nodeBytes();
+	current[MEM_QUEUES] += nodes;
+	current[SLOT_TOTAL] += nodes;
+
+	for( uint32_t s = 0; s < SLOT_COUNT; ++s ) {
+		int64_t     peak    = atomic_load_explicit(&peaks[s], memory_order_relaxed);
+		peak    = current[s] > peak ? current[s] : peak;
+		if( s == SLOT_TOTAL ) {
+			stats->total        = current[s];
+			stats->totalPeak    = peak;
+		} else {
+			stats->current[s]   = current[s];
+			stats->peak[s]      = peak;
+		}
+	}
+	return true;
+}
+
+#else
+
+bool
+MemStats_collect(MemStats* stats) {
+	memset(stats, 0, sizeof(MemStats));
+	return false;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory Accounting
+////////////////////////////////////////////////////////////////////////////////
+//
+// compiled in with MEM_STATS only, MEM_TRACK expands to nothing otherwise.
+// Every thread counts the bytes it allocates and frees in its own shard,
+// MemStats_collect sums the shards on demand. Shards publish their balance to
+// shared counters every MEM_STATS_SLACK bytes to maintain the high-water marks,
+// a peak is therefore exact within MEM_STATS_SLACK bytes per thread.
+//
+// The counters are global to the program, not per VM.
+//
+
+#define MEM_STATS_SLACK     (64 * 1024)
+
+typedef enum {
+	MEM_SEGMENTS    = 0,    // functions, code, chars, processes and compiler tables (reserved)
+	MEM_STACKS,             // process stack arenas (reserved)
+	MEM_MAP,                // map buffers (slab blocks)
+	MEM_REGIONS,            // process region chunks
+	MEM_BUFFERS,            // shared buffers and slices
+	MEM_MESSAGES,
+	MEM_QUEUES,             // mailboxes, links and unbounded queue nodes
+	MEM_STREAMS,
+	MEM_CATEGORY_COUNT
+} MemCategory;
+
+typedef struct {
+	int64_t         current[MEM_CATEGORY_COUNT];    // bytes in use
+	int64_t         peak[MEM_CATEGORY_COUNT];       // high-water marks
+	uint64_t        allocs[MEM_CATEGORY_COUNT];
+	uint64_t        frees[MEM_CATEGORY_COUNT];
+	int64_t         total;
+	int64_t         totalPeak;
+} MemStats;
+
+extern const char*  MemCategory_names[MEM_CATEGORY_COUNT];
+
+//
+// sum the counters of all threads
+// Return: false if compiled without MEM_STATS (stats are zeroed)
+//
+bool        MemStats_collect(MemStats* stats);
+
+#ifdef MEM_STATS
+/// count an allocation (bytes > 0) or a release (bytes < 0)
+void        MemStats_add(MemCategory cat, int64_t bytes);
+#   define MEM_TRACK(cat, bytes)    MemStats_add((cat), (bytes))
+#else
+#   define MEM_TRACK(cat, bytes)
+#endif
@@ -0,0 +1,525 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "internals.h"
+
+#define FNV_OFFSET      0xCBF29CE484222325ULL
+#define FNV_PRIME       0x100000001B3ULL
+
+bool
+vmModuleHash(const char* path, uint64_t* hash) {
+	FILE*   f   = fopen(path, "rb");
+	if( f == NULL ) {
+		return false;
+	}
+
+	uint8_t     chunk[4096];
+	size_t      size;
+	uint64_t    h   = FNV_OFFSET;
+	while( (size = fread(chunk, 1, sizeof(chunk), f)) != 0 ) {
+		for( size_t i = 0; i < size; ++i ) {
+			h   = (h ^ chunk[i]) * FNV_PRIME;
+		}
+	}
+	bool    isOk    = !ferror(f);
+	fclose(f);
+	*hash   = h;
+	return isOk;
+}
+
+// Return: hash of the opcode names in index order, the code calls opcodes by index
+static
+uint64_t
+opcodeHash(const VM* vm) {
+	uint64_t    h   = FNV_OFFSET;
+	for( uint32_t op = 0; op < vmOpcodeCount(); ++op ) {
+		const char* name    = &vm->chars[vm->funcs[op].nameOffset];
+		do {
+			h   = (h ^ (uint8_t)*name) * FNV_PRIME;
+		} while( *name++ != '\0' );
+	}
+	return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Writer
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const VM*       vm;
+	const ModuleRecorder*   rec;
+	uint32_t        funcEnd;
+
+	char*           chars;
+	uint32_t        charCount;
+	uint32_t        charCap;
+	uint32_t*       strings;        // const string offsets
+	uint32_t        stringCount;
+
+	uint32_t*       exts;           // global indices of the external functions
+	uint32_t*       extNames;
+	uint32_t        extCount;
+
+	bool            isOk;
+} ModuleWriter;
+
+// Return: the const string id of str
+static
+uint32_t
+addString(ModuleWriter* w, const char* str) {
+	uint32_t    size    = (uint32_t)strlen(str) + 1;
+	if( w->charCount + size > w->charCap ) {
+		uint32_t    cap     = 2 * (w->charCount + size);
+		char*       chars   = realloc(w->chars, cap);
+		if( chars == NULL ) {
+			w->isOk = false;
+			return 0;
+		}
+		w->chars    = chars;
+		w->charCap  = cap;
+	}
+	memcpy(&w->chars[w->charCount], str, size);
+	w->strings[w->stringCount]  = w->charCount;
+	w->charCount    += size;
+	return w->stringCount++;
+}
+
+//
+// Return: the module reference of the global function funcId, externals are
+//         added to the external function table on first use
+//
+static
+uint32_t
+encodeRef(ModuleWriter* w, uint32_t funcId) {
+	const VM*   vm  = w->vm;
+	if( funcId < vmOpcodeCount() ) {
+		return MODULE_REF(MODULE_HW, funcId);
+	} else if( funcId >= w->rec->funcStart && funcId < w->funcEnd ) {
+		return MODULE_REF(MODULE_SELF, funcId - w->rec->funcStart);
+	}
+
+	for( uint32_t e = 0; e < w->extCount; ++e ) {
+		if( w->exts[e] == funcId ) {
+			return MODULE_REF(MODULE_EXTERN, e);
+		}
+	}
+
+	// linked by name, the name must lead to this very function (no lambdas or
+	// shadowed words)
+	const char* name    = funcId < vm->funcCount && vm->funcs[funcId].nameOffset != VM_NO_NAME ? &vm->chars[vm->funcs[funcId].nameOffset] : NULL;
+	if( name == NULL || vmFindFunction((VM*)vm, name) != funcId + 1 || w->extCount > MODULE_FUNCTION_MASK ) {
+		w->isOk = false;
+		return 0;
+	}
+	w->exts[w->extCount]        = funcId;
+	w->extNames[w->extCount]    = addString(w, name);
+	return MODULE_REF(MODULE_EXTERN, w->extCount++);
+}
+
+bool
+vmModuleSave(VM* vm, const ModuleRecorder* rec, const char* path, const char* sourceName, uint64_t sourceHash) {
+	uint32_t        intCount    = vm->funcCount - rec->funcStart;
+	uint32_t        insCount    = vm->insCount  - rec->insStart;
+	if( intCount > MODULE_FUNCTION_MASK + 1 ) {
+		return false;
+	}
+
+	// every function may be named once and reference at most one external
+	uint32_t        maxStrings  = 1 + intCount + insCount;
+	ModuleWriter    w   = {
+		.vm         = vm,
+		.rec        = rec,
+		.funcEnd    = vm->funcCount,
+		.strings    = malloc(maxStrings * sizeof(uint32_t)),
+		.exts       = malloc((insCount + 1) * sizeof(uint32_t)),
+		.extNames   = malloc((insCount + 1) * sizeof(uint32_t)),
+		.isOk       = true,
+	};
+	// the function literals of the file are the last relocations
+	const uint32_t* refs    = &vm->relocs[vmFirstRelocation(vm, rec->insStart)];
+	uint32_t        refCount= (uint32_t)(&vm->relocs[vm->relocCount] - refs);
+	ModuleFunction* funcs   = malloc((intCount + 1) * sizeof(ModuleFunction));
+	uint32_t*       ins     = malloc((insCount + 1) * sizeof(uint32_t));
+	uint32_t*       at      = malloc((insCount + 1) * sizeof(uint32_t));  // code offset of each instruction
+	w.isOk  = w.strings && w.exts && w.extNames && funcs && ins && at;
+
+	uint32_t        moduleNameId    = w.isOk ? addString(&w, sourceName) : 0;
+	for( uint32_t f = 0; w.isOk && f < intCount; ++f ) {
+		const Function* func    = &vm->funcs[rec->funcStart + f];
+		w.isOk  = func->type == FT_INTERP && (func->u.interp.insCount == 0 || func->u.interp.insOffset >= rec->insStart);
+		if( !w.isOk ) {
+			break;
+		}
+		funcs[f]    = (ModuleFunction) {
+			.nameId         = func->nameOffset != VM_NO_NAME ? addString(&w, &vm->chars[func->nameOffset]) : MODULE_NO_NAME,
+			.isImmediate    = func->isImmediate,
+			.insOffset      = func->u.interp.insCount ? func->u.interp.insOffset - rec->insStart : 0,
+			.insCount       = func->u.interp.insCount,
+		};
+	}
+
+	uint32_t        r       = 0;
+	uint32_t        codeSize= 0;
+	for( uint32_t i = 0; w.isOk && i < insCount; ++i ) {
+		uint32_t    op  = vm->ins[rec->insStart + i];
+		if( r < refCount && refs[r] == rec->insStart + i ) {
+			ins[i]  = encodeRef(&w, op);
+			++r;
+		} else if( op & OP_CALL ) {
+			ins[i]  = encodeRef(&w, op & OP_CALL_MASK);
+		} else {
+			ins[i]  = op;
+		}
+		at[i]       = codeSize;
+		codeSize    += (uint32_t)Bytecode_size(&ins[i], 1);
+	}
+
+	// the functions know where their code starts once it is encoded
+	uint8_t*        code    = w.isOk ? malloc((size_t)codeSize + 1) : NULL;
+	w.isOk  = w.isOk && code;
+	for( uint32_t i = 0; w.isOk && i < insCount; ++i ) {
+		Bytecode_encode(ins[i], &code[at[i]]);
+	}
+	for( uint32_t f = 0; w.isOk && f < intCount; ++f ) {
+		funcs[f].codeOffset = funcs[f].insCount ? at[funcs[f].insOffset] : 0;
+	}
+
+	ModuleHeader    hdr = {
+		.magic              = MODULE_MAGIC,
+		.versionMajor       = MODULE_VERSION_MAJOR,
+		.versionMinor       = MODULE_VERSION_MINOR,
+		.versionRev         = MODULE_VERSION_REV,
+		.opcodeCount        = vmOpcodeCount(),
+		.sourceHash         = sourceHash,
+		.opcodeHash         = opcodeHash(vm),
+		.constStringCount   = w.stringCount,
+		.charCount          = w.charCount,
+		.extFunctionCount   = w.extCount,
+		.intFunctionCount   = intCount,
+		.moduleNameId       = moduleNameId,
+		.instructionCount   = insCount,
+		.relocationCount    = refCount,
+		.codeSize           = codeSize,
+	};
+
+	// written aside and renamed, a reader never sees half a module
+	char            tmpName[MAX_TOKEN_SIZE + 8];
+	FILE*           f       = NULL;
+	if( w.isOk && r == refCount
+	 && snprintf(tmpName, sizeof(tmpName), "%s.tmp", path) < (int)sizeof(tmpName)
+	 && (f = fopen(tmpName, "wb")) != NULL ) {
+		uint32_t*   relocs  = malloc((refCount + 1) * sizeof(uint32_t));
+		for( uint32_t i = 0; relocs && i < refCount; ++i ) {
+			relocs[i]   = refs[i] - rec->insStart;
+		}
+		w.isOk  = relocs
+		       && fwrite(&hdr, sizeof(ModuleHeader), 1, f) == 1
+		       && fwrite(w.strings, sizeof(uint32_t), w.stringCount, f) == w.stringCount
+		       && fwrite(funcs, sizeof(ModuleFunction), intCount, f) == intCount
+		       && fwrite(w.extNames, sizeof(uint32_t), w.extCount, f) == w.extCount
+		       && fwrite(relocs, sizeof(uint32_t), refCount, f) == refCount
+		       && fwrite(w.chars, 1, w.charCount, f) == w.charCount
+		       && fwrite(code, 1, codeSize, f) == codeSize;
+		w.isOk  = (fclose(f) == 0) && w.isOk;
+		w.isOk  = w.isOk ? rename(tmpName, path) == 0 : (unlink(tmpName), false);
+		free(relocs);
+	} else {
+		w.isOk  = false;
+	}
+
+	free(w.chars);
+	free(w.strings);
+	free(w.exts);
+	free(w.extNames);
+	free(funcs);
+	free(ins);
+	free(at);
+	free(code);
+	return w.isOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loader
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	const ModuleHeader*     hdr;
+	const uint32_t*         strings;
+	const ModuleFunction*   funcs;
+	const uint32_t*         extNames;
+	const uint32_t*         relocs;
+	const char*             chars;
+	const uint8_t*          code;
+} ModuleView;
+
+//
+// locate the sections of the mapped module
+// Return: false if they do not fit in size bytes
+//
+static
+bool
+viewModule(ModuleView* m, const uint8_t* data, size_t size) {
+	if( size < sizeof(ModuleHeader) ) {
+		return false;
+	}
+
+	const ModuleHeader* hdr = (const ModuleHeader*)data;
+	uint64_t    offset  = sizeof(ModuleHeader);
+	m->hdr      = hdr;
+	m->strings  = (const uint32_t*)(data + offset);         offset  += (uint64_t)hdr->constStringCount * sizeof(uint32_t);
+	m->funcs    = (const ModuleFunction*)(data + offset);   offset  += (uint64_t)hdr->intFunctionCount * sizeof(ModuleFunction);
+	m->extNames = (const uint32_t*)(data + offset);         offset  += (uint64_t)hdr->extFunctionCount * sizeof(uint32_t);
+	m->relocs   = (const uint32_t*)(data + offset);         offset  += (uint64_t)hdr->relocationCount  * sizeof(uint32_t);
+	m->chars    = (const char*)(data + offset);             offset  += hdr->charCount;
+	m->code     = data + offset;                            offset  += hdr->codeSize;
+	return offset <= size && (hdr->charCount == 0 || m->chars[hdr->charCount - 1] == '\0');
+}
+
+// Return: the string id, NULL if it is out of the string table
+static inline
+const char*
+moduleString(const ModuleView* m, uint32_t id) {
+	return id < m->hdr->constStringCount && m->strings[id] < m->hdr->charCount ? &m->chars[m->strings[id]] : NULL;
+}
+
+// Return: false if ref points past the HW module, the module or its externals
+static inline
+bool
+isValidRef(const ModuleView* m, uint32_t ref) {
+	uint32_t    fn  = MODULE_REF_FUNCTION(ref);
+	switch( MODULE_REF_MODULE(ref) ) {
+	case MODULE_HW:     return fn < vmOpcodeCount();
+	case MODULE_SELF:   return fn < m->hdr->intFunctionCount;
+	case MODULE_EXTERN: return fn < m->hdr->extFunctionCount;
+	default:            return false;
+	}
+}
+
+static inline
+uint32_t
+linkRef(uint32_t ref, uint32_t base, const uint32_t* exts) {
+	uint32_t    fn  = MODULE_REF_FUNCTION(ref);
+	switch( MODULE_REF_MODULE(ref) ) {
+	case MODULE_HW:     return fn;
+	case MODULE_SELF:   return base + fn;
+	default:            return exts[fn];
+	}
+}
+
+//
+// check the module tables against the VM before it is touched, the code of
+// each function is decoded and checked when it is materialized
+// Return: false if the module is corrupt, a word is missing or it does not fit
+//
+static
+bool
+checkModule(const VM* vm, const ModuleView* m, uint32_t* exts) {
+	const ModuleHeader* hdr = m->hdr;
+	uint64_t    nameBytes   = 0;
+	for( uint32_t f = 0; f < hdr->intFunctionCount; ++f ) {
+		const char* name    = moduleString(m, m->funcs[f].nameId);
+		bool        isAnon  = m->funcs[f].nameId == MODULE_NO_NAME;
+		if( (name == NULL && !isAnon) || m->funcs[f].insOffset > hdr->instructionCount || m->funcs[f].insCount > hdr->instructionCount - m->funcs[f].insOffset
+		 || m->funcs[f].codeOffset > hdr->codeSize ) {
+			return false;
+		}
+		nameBytes   += isAnon ? 0 : strlen(name) + 1;
+	}
+
+	// one dictionary lookup per external word, none per call
+	for( uint32_t e = 0; e < hdr->extFunctionCount; ++e ) {
+		const char* name    = moduleString(m, m->extNames[e]);
+		uint32_t    fidx    = name ? vmFindFunction((VM*)vm, name) : 0;
+		if( fidx == 0 ) {
+			return false;
+		}
+		exts[e] = fidx - 1;
+	}
+
+	// materializing looks the relocations of a function up by bisection
+	for( uint32_t r = 0; r < hdr->relocationCount; ++r ) {
+		if( m->relocs[r] >= hdr->instructionCount || (r > 0 && m->relocs[r] <= m->relocs[r - 1]) ) {
+			return false;
+		}
+	}
+
+	return hdr->intFunctionCount <= vm->funCap - vm->funcCount
+	    && nameBytes <= vm->charCap - vm->charCount;
+}
+
+// Return: false if the module table is full and cannot grow
+static
+bool
+addLoadedModule(VM* vm, LoadedModule lm) {
+	if( vm->modules.count == vm->modules.cap ) {
+		uint32_t        cap     = vm->modules.cap ? 2 * vm->modules.cap : 8;
+		LoadedModule*   list    = realloc(vm->modules.list, cap * sizeof(LoadedModule));
+		if( list == NULL ) {
+			return false;
+		}
+		vm->modules.list    = list;
+		vm->modules.cap     = cap;
+	}
+	vm->modules.list[vm->modules.count++]   = lm;
+	return true;
+}
+
+bool
+vmModuleLoad(Process* proc, const char* path, uint64_t sourceHash) {
+	VM*     vm  = proc->vm;
+	int     fd  = open(path, O_RDONLY);
+	if( fd < 0 ) {
+		return false;
+	}
+
+	struct stat st;
+	uint8_t*    data    = MAP_FAILED;
+	uint32_t*   exts    = NULL;
+	ModuleView  m;
+	bool        isOk    = fstat(fd, &st) == 0
+	                   && (data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED
+	                   && viewModule(&m, data, (size_t)st.st_size)
+	                   && memcmp(m.hdr->magic, MODULE_MAGIC, sizeof(m.hdr->magic)) == 0
+	                   && m.hdr->versionMajor == MODULE_VERSION_MAJOR
+	                   && m.hdr->opcodeCount == vmOpcodeCount()
+	                   && m.hdr->opcodeHash == opcodeHash(vm)
+	                   && m.hdr->sourceHash == sourceHash
+	                   && (exts = malloc((m.hdr->extFunctionCount + 1) * sizeof(uint32_t))) != NULL
+	                   && checkModule(vm, &m, exts);
+	close(fd);
+
+	// workers materializing functions read the table
+	pthread_mutex_lock(&vm->codeLock);
+	uint32_t    module  = vm->modules.count;
+	isOk    = isOk && addLoadedModule(vm, (LoadedModule){ .data = data, .size = (size_t)st.st_size, .base = vm->funcCount, .exts = exts });
+	pthread_mutex_unlock(&vm->codeLock);
+
+	if( !isOk ) {
+		free(exts);
+		if( data != MAP_FAILED ) {
+			munmap(data, (size_t)st.st_size);
+		}
+		return false;
+	}
+
+	// only the entries, the code is copied on first call. Lambdas have no name
+	for( uint32_t f = 0; f < m.hdr->intFunctionCount; ++f ) {
+		uint32_t    fidx    = vmAllocateInterpFunction(proc, moduleString(&m, m.funcs[f].nameId));
+		assert(fidx == vm->modules.list[module].base + f);
+		vm->funcs[fidx].isImmediate = m.funcs[f].isImmediate != 0;
+		vm->funcs[fidx].u.lazy      = (LazyFunction){ .module = module, .function = f };
+		vm->funcs[fidx].type        = FT_LAZY;
+	}
+	vm->modules.lazyCount   += m.hdr->intFunctionCount;
+	return true;
+}
+
+// Return: the index of the first relocation at or after ins
+static
+uint32_t
+firstReloc(const ModuleView* m, uint32_t ins) {
+	uint32_t    lo  = 0;
+	uint32_t    hi  = m->hdr->relocationCount;
+	while( lo < hi ) {
+		uint32_t    mid = lo + (hi - lo) / 2;
+		if( m->relocs[mid] < ins ) {
+			lo  = mid + 1;
+		} else {
+			hi  = mid;
+		}
+	}
+	return lo;
+}
+
+bool
+vmModuleMaterialize(VM* vm, uint32_t fidx, ExceptFlags* flags) {
+	bool        isOk    = true;
+	pthread_mutex_lock(&vm->codeLock);
+	Function*   func    = &vm->funcs[fidx];
+	if( func->type != FT_LAZY ) {
+		pthread_mutex_unlock(&vm->codeLock);
+		return true;        // another worker was first
+	}
+
+	// the view was checked by vmModuleLoad
+	const LoadedModule*     lm  = &vm->modules.list[func->u.lazy.module];
+	ModuleView              m;
+	viewModule(&m, lm->data, lm->size);
+	const ModuleFunction*   mf  = &m.funcs[func->u.lazy.function];
+
+	// decoded and checked before anything is reserved, a corrupt function gets
+	// an empty body
+	uint32_t        first   = firstReloc(&m, mf->insOffset);
+	uint32_t        r       = first;
+	size_t          pos     = mf->codeOffset;
+	InterpFunction  body    = { .insOffset = vm->insCount, .insCount = mf->insCount };
+	for( uint32_t i = 0; i < mf->insCount; ++i ) {
+		uint32_t    op;
+		bool        isRef   = r < m.hdr->relocationCount && m.relocs[r] == mf->insOffset + i;
+		if( !Bytecode_decode(m.code, m.hdr->codeSize, &pos, &op) || ((isRef || (op & OP_CALL)) && !isValidRef(&m, op)) ) {
+			char    nameBuf[VM_NAME_SIZE];
+			fprintf(stderr, "Error: module word %s is corrupt\n", vmFunctionName(vm, fidx, nameBuf));
+			body.insCount   = 0;
+			break;
+		}
+		r   += isRef;
+	}
+
+	if( vmReserveInstructions(vm, body.insCount, flags) ) {
+		r   = first;
+		pos = mf->codeOffset;
+		for( uint32_t i = 0; i < body.insCount; ++i ) {
+			uint32_t    op;
+			bool        isRef   = r < m.hdr->relocationCount && m.relocs[r] == mf->insOffset + i;
+			Bytecode_decode(m.code, m.hdr->codeSize, &pos, &op);
+			vm->ins[body.insOffset + i] = isRef ? linkRef(op, lm->base, lm->exts) : (op & OP_CALL) ? OP_CALL | linkRef(op, lm->base, lm->exts) : op;
+			if( isRef ) {
+				vmPushRelocation(vm, body.insOffset + i);   // fits, as many as instructions
+				++r;
+			}
+		}
+		vm->insCount    += body.insCount;
+
+		// a fetch that sees the type sees the body
+		func->u.interp  = body;
+		atomic_thread_fence(memory_order_release);
+		func->type      = FT_INTERP;
+		atomic_fetch_add_explicit(&vm->modules.materialized, 1, memory_order_relaxed);
+	} else {
+		isOk    = false;    // stays lazy, the caller aborts on insOF
+	}
+	pthread_mutex_unlock(&vm->codeLock);
+	return isOk;
+}
+
+void
+vmModuleReleaseAll(VM* vm) {
+	for( uint32_t i = 0; i < vm->modules.count; ++i ) {
+		munmap((void*)vm->modules.list[i].data, vm->modules.list[i].size);
+		free(vm->modules.list[i].exts);
+	}
+	free(vm->modules.list);
+	vm->modules.list        = NULL;
+	vm->modules.count       = 0;
+	vm->modules.cap         = 0;
+	vm->modules.lazyCount   = 0;
+	atomic_store_explicit(&vm->modules.materialized, 0, memory_order_relaxed);
+}
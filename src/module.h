@@ -19,11 +19,10 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-typedef struct Process Process;
+#include <stddef.h>
 
 //
-// instruction format:
+// instruction format (in module files):
 //
 // 0 | XXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX   : Literal
 // 1 | MMMMMMM MMMMFFFF FFFFFFFF FFFFFFFF   : function call (M: Module bit, F: Function bit) : 2048 modules, 2^20 functions
@@ -31,39 +30,54 @@ typedef struct Process Process;
 // Notes:
 //  1. module 0x000 refers to the CPU implemented opcode module (HW module)
 //  2. module 0x7FF refers to the current module
+//  3. module 0x001 refers to the external function table, linked by name
+//  4. literals holding a function (lambdas, @) use the call format and are
+//     listed in the relocation table
+//
+// The VM runs global function indices, the loader rewrites every reference.
+// The instructions are stored in the compact bytecode (bytecode.h).
 //
 
-typedef struct {
-    uint32_t        insOffset;
-    uint32_t        insCount;
-} InterpFunction;
+#define MODULE_HW               0x000
+#define MODULE_EXTERN           0x001
+#define MODULE_SELF             0x7FF
 
-typedef void (*NativeFunction)(Process* proc);
+#define MODULE_FUNCTION_BITS    20
+#define MODULE_FUNCTION_MASK    ((1u << MODULE_FUNCTION_BITS) - 1)
+#define MODULE_ID_MASK          0x7FF
 
-typedef enum {
-    FT_INTERP   = 0,
-    FT_NATIVE   = 1,
-} FunctionType;
+#define MODULE_REF(M, F)        (0x80000000u | ((uint32_t)(M) << MODULE_FUNCTION_BITS) | (uint32_t)(F))
+#define MODULE_REF_MODULE(R)    (((R) >> MODULE_FUNCTION_BITS) & MODULE_ID_MASK)
+#define MODULE_REF_FUNCTION(R)  ((R) & MODULE_FUNCTION_MASK)
 
-typedef struct {
-    FunctionType    type;
-    bool            isImmediate;
-    uint32_t        nameOffset;
-    uint32_t        inVS;           // numner of input values to pop from the value stack
-    uint32_t        outVS;          // number of output values to push to the value stack
-    union {
-        InterpFunction  interp;
-        NativeFunction  native;
-    } u;
-} Function;
+#define MODULE_MAGIC            "ncvmmod"
+#define MODULE_NO_NAME          0xFFFFFFFF
+#define MODULE_VERSION_MAJOR    4
+#define MODULE_VERSION_MINOR    0
+#define MODULE_VERSION_REV      0
 
+//
+// file layout, sections follow the header in this order:
+//
+//  uint32_t        constStringTable[constStringCount]  (offsets in the char block)
+//  ModuleFunction  intFunctionTable[intFunctionCount]
+//  uint32_t        extFunctionTable[extFunctionCount]  (const string ids)
+//  uint32_t        relocations[relocationCount]        (ascending instruction indices)
+//  char            chars[charCount]
+//  uint8_t         code[codeSize]                      (instructionCount instructions)
+//
 typedef struct {
+    char        magic[8];
     uint32_t    versionMajor;       // module major version
     uint32_t    versionMinor;       // module minor version
     uint32_t    versionRev;         // module revision version
 
-    uint32_t    extModuleCount;     // external module count
+    uint32_t    opcodeCount;        // HW module size the module was built against
+    uint64_t    sourceHash;         // hash of the source file (vmModuleHash)
+    uint64_t    opcodeHash;         // hash of the HW module names in index order
+
     uint32_t    constStringCount;   // constant string count
+    uint32_t    charCount;          // constant string bytes
 
     uint32_t    extFunctionCount;   // externally referenced function count
     uint32_t    intFunctionCount;   // internally defined function count
@@ -71,10 +85,35 @@ typedef struct {
     uint32_t    moduleNameId;       // inside the string table
 
     uint32_t    instructionCount;   // total instruction count
+    uint32_t    relocationCount;    // function literals
+    uint32_t    codeSize;           // bytes of the encoded instructions
+} ModuleHeader;
 
-    Function*   intFunctionTable;
-    uint32_t*   constStringTable;   // constant string offsets
-    uint32_t*   instructions;       // instruction block
+typedef struct {
+    uint32_t    nameId;             // inside the string table, MODULE_NO_NAME for lambdas
+    uint32_t    isImmediate;
+    uint32_t    insOffset;          // inside the module instructions
+    uint32_t    insCount;
+    uint32_t    codeOffset;         // of its first instruction in the code bytes
+} ModuleFunction;
+
+//
+// words compiled while a source file is loaded, written as a module once the
+// file is done. A file is only cached if loading it did nothing but define
+// words, anything else it runs would not be replayed by the module
+//
+typedef struct {
+    uint32_t    funcStart;          // first function defined by the file
+    uint32_t    insStart;           // first instruction compiled for the file
+    bool        isCacheable;
+} ModuleRecorder;
+
+// a module mapped by the loader, its functions are materialized on first call
+typedef struct {
+    const uint8_t*  data;           // mapped module file
+    size_t          size;
+    uint32_t        base;           // global index of the first module function
+    uint32_t*       exts;           // global indices of the external functions
+} LoadedModule;
 
-} Module;
 #endif // NCVM_MODULE__H
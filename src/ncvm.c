@@ -15,10 +15,18 @@
 **  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <sys/mman.h>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <stddef.h>
 #include "internals.h"
 
-#define U32V(V) (Value) { .u32 = V }
-#define I32V(V) (Value) { .i32 = V }
+// the upper half stays clear, a function index must not read as a closure
+#define U32V(V) (Value) { .u64 = (uint32_t)(V) }
+#define I32V(V) (Value) { .u64 = (uint32_t)(int32_t)(V) }
+#define NO_STRING   0xFFFFFFFF  /* addConstString: the char segment is full */
 
 typedef enum {
 	OP_NOP      = 0,
@@ -88,6 +96,16 @@ typedef enum {
     OP_VS,              // get Value Stack size
     OP_RS,              // get Return stack size
 
+	OP_CLOSURE,         // capture values with a lambda
+	OP_READ_CAPTURE,    // read a value captured by the running closure
+	OP_FREE_CLOSURE,
+
+	OP_GEN_NEW,         // generator running a lambda on its own stacks
+	OP_GEN_NEXT,        // resume a generator until it yields or returns
+	OP_GEN_YIELD,       // hand a value back to the resumer of the generator
+	OP_GEN_FREE,
+
+	// images and modules call opcodes by index, new ones go here
     OP_MAX,
 } OPCODE;
 
@@ -156,19 +174,27 @@ static Opcode opcodes[OP_MAX] = {
 	[OP_UNMAP]      = { "unmap",    1,  0 },    // addr --
 
 	[OP_YIELD]      = { "yield",    0,  0 },    // --
-    [OP_TRY_SEND]   = { "try.send", 3,  1 },    // mem-addr mem-size pid --
-    [OP_TRY_RECV]   = { "try.recv", 1,  2 },    // pid -- mem-addr mem-size
+    [OP_TRY_SEND]   = { "try.send", 3,  1 },    // mem-addr mem-size pid -- ok
+    [OP_TRY_RECV]   = { "try.recv", 0,  3 },    // -- mem-addr mem-size ok
     [OP_SPAWN]      = { "spawn",    2,  1 },    // queue-size lambda -- pid
 	[OP_PID]        = { "pid",      0,  1 },    // -- pid
 
     [OP_VS]         = { "vs.size",  0,  1 },
     [OP_RS]         = { "rs.size",  0,  1 },
+
+	[OP_CLOSURE]    = { "clo.new",  2,  1 },    // v0 .. vn-1 n lambda -- closure
+	[OP_READ_CAPTURE]={ "clo.read", 1,  1 },    // i -- vi
+	[OP_FREE_CLOSURE]={ "clo.free", 1,  0 },    // closure --
+
+	[OP_GEN_NEW]    = { "gen.new",  1,  1 },    // lambda -- gen
+	[OP_GEN_NEXT]   = { "gen.next", 1,  2 },    // gen -- value more
+	[OP_GEN_YIELD]  = { "gen.yield",1,  0 },    // value --
+	[OP_GEN_FREE]   = { "gen.free", 1,  0 },    // gen --
 };
 
 INLINE
 void
 pushValue(Process* proc, Value v) {
-	assert(proc->vsCount < proc->vsCap);
 	proc->vs[proc->vsCount] = v;
 	++proc->vsCount;
 }
@@ -184,7 +210,6 @@ popValue(Process* proc) {
 INLINE
 void
 pushLocal(Process* proc, Value v) {
-	assert(proc->lsCount < proc->lsCap);
 	proc->ls[proc->lsCount] = v;
 	++proc->lsCount;
 }
@@ -199,7 +224,7 @@ getLocalValue(Process* proc, uint32_t lidx) {
 INLINE
 void
 pushReturn(Process* proc) {
-	Return r = { .fp = proc->fp, .ip = proc->ip, .lp = proc->lp };
+	Return r = { .fp = proc->fp, .ip = proc->ip, .lp = proc->lp, .closure = proc->closure };
 	proc->rs[proc->rsCount] = r;
 	++proc->rsCount;
 }
@@ -212,6 +237,53 @@ popReturn(Process* proc) {
 	proc->fp  = r.fp;
 	proc->ip  = r.ip;
 	proc->lp  = r.lp;
+	proc->closure   = r.closure;
+}
+
+//
+// a closure becomes the running closure, a lambda keeps the one it runs in
+// (the branches of a cond see the captures of the closure around them)
+// Return: the function of a lambda or closure
+//
+INLINE
+uint32_t
+enterCallable(Process* proc, Value v) {
+	if( vmIsClosure(v) ) {
+		proc->closure   = vmClosureOf(v);
+		return proc->closure->func;
+	}
+	return v.u32;
+}
+
+//
+// set by vmRunSlice while it runs a process on this thread: instructions raising
+// an exception leave the slice through it, so the dispatch loop does not check
+// the flags after every instruction. NULL while a native runs, a native (load)
+// may run words of its own outside of any slice
+//
+static _Thread_local sigjmp_buf*    interruptJump   = NULL;
+
+INLINE
+void
+interruptSlice() {
+	if( interruptJump ) {
+		siglongjmp(*interruptJump, 1);
+	}
+}
+
+//
+// one reduction per dispatched call/tail call/cond, when the budget runs out the
+// process is flagged for descheduling and leaves its slice. Counted once the
+// call is set up so the process can resume from fp/ip
+//
+INLINE
+void
+countReduction(Process* proc) {
+	if( --proc->reductions == 0 ) {
+		proc->reductions                = proc->reductionBudget;
+		proc->exceptFlags.indiv.yF      = true;
+		interruptSlice();
+	}
 }
 
 INLINE
@@ -226,20 +298,144 @@ getOperand(uint32_t opcode) {
 	return opcode & OP_CALL_MASK;
 }
 
+// map keeps the calloc semantics, buffers come from the process region or the
+// worker slab heap and may be unmapped from any worker (a no-op for region ones)
+static
+void*
+mapBuffer(Process* proc, uint32_t size) {
+	if( proc->useRegion ) {
+		size_t  mapped  = proc->region.mapped;
+		void*   buff    = SlabRegion_alloc(&proc->region, size);
+		vmMemTrack(proc, MEM_REGIONS, (int64_t)(proc->region.mapped - mapped));
+		return buff;
+	}
+
+	void*   buff    = Slab_alloc(size);
+	if( buff ) {
+		memset(buff, 0, size);
+		vmMemTrack(proc, MEM_MAP, (int64_t)Slab_size(buff));
+	}
+	return buff;
+}
+
+static
+void
+unmapBuffer(Process* proc, void* buff) {
+	if( buff && !Slab_isRegion(buff) ) {
+		vmMemTrack(proc, MEM_MAP, -(int64_t)Slab_size(buff));
+		Slab_free(buff);
+	}
+}
+
+//
+// move the count values under the lambda into a closure, allocated like a map
+// buffer (clo.free unmaps it)
+// Return: the closure, function 0 (nop) if out of memory
+//
+static
+Value
+newClosure(Process* proc, uint32_t func, uint32_t count) {
+	assert(count <= proc->vsCount);
+	Closure*    clo     = mapBuffer(proc, (uint32_t)(sizeof(Closure) + (size_t)count * sizeof(Value)));
+	proc->vsCount   -= count;
+	if( clo == NULL ) {
+		return U32V(0);
+	}
+	clo->func   = func;
+	clo->count  = count;
+	memcpy(clo->values, &proc->vs[proc->vsCount], (size_t)count * sizeof(Value));
+	return (Value) { .u64 = VM_CLOSURE_TAG | (uint64_t)(uintptr_t)clo };
+}
+
+static inline
+size_t
+pageAlign(const VM* vm, size_t size) {
+	return (size + vm->pageSize - 1) & ~(vm->pageSize - 1);
+}
+
+//
+// the code, function and char segments are reserved up to their hard limit and
+// grow in place, offsets into them stay valid. The pages a segment grows into
+// are accounted when reached
+// Return: false if n more elements of size bytes do not fit under cap
+//
+static
+bool
+growSegment(VM* vm, uint32_t count, uint32_t n, uint32_t cap, size_t size) {
+	if( n > cap - count ) {
+		return false;
+	}
+	vmMemTrack(NULL, MEM_SEGMENTS, (int64_t)(pageAlign(vm, (size_t)(count + n) * size) - pageAlign(vm, (size_t)count * size)));
+	return true;
+}
+
+uint32_t
+vmOpcodeCount() {
+	return OP_MAX;
+}
+
+void
+vmSetSegmentCounts(VM* vm, uint32_t funcCount, uint32_t insCount, uint32_t charCount, uint32_t relocCount) {
+	vmMemTrack(NULL, MEM_SEGMENTS, (int64_t)(pageAlign(vm, (size_t)funcCount * sizeof(Function)) - pageAlign(vm, (size_t)vm->funcCount * sizeof(Function))
+	                                       + pageAlign(vm, (size_t)insCount * sizeof(uint32_t))  - pageAlign(vm, (size_t)vm->insCount * sizeof(uint32_t))
+	                                       + pageAlign(vm, charCount)                            - pageAlign(vm, vm->charCount)
+	                                       + pageAlign(vm, (size_t)relocCount * sizeof(uint32_t)) - pageAlign(vm, (size_t)vm->relocCount * sizeof(uint32_t))));
+	vm->funcCount   = funcCount;
+	vm->insCount    = insCount;
+	vm->charCount   = charCount;
+	vm->relocCount  = relocCount;
+
+	uint32_t    wordCount   = 0;
+	for( uint32_t fidx = 0; fidx < funcCount; ++fidx ) {
+		if( vm->funcs[fidx].nameOffset != VM_NO_NAME ) {
+			vm->words[wordCount++]  = fidx;
+		}
+	}
+	vmMemTrack(NULL, MEM_SEGMENTS, (int64_t)(pageAlign(vm, (size_t)wordCount * sizeof(uint32_t)) - pageAlign(vm, (size_t)vm->wordCount * sizeof(uint32_t))));
+	vm->wordCount   = wordCount;
+}
+
+// Return: the string offset, NO_STRING if the char segment is full
 static
 uint32_t
 addConstString(VM* vm, const char* str) {
+	size_t      size    = strlen(str) + 1;
 	uint32_t    strIdx  = vm->charCount;
-	while(*str) {
-		vm->chars[vm->charCount] = *str;
-		++str;
-		++vm->charCount;
+	if( size > vm->charCap || !growSegment(vm, vm->charCount, (uint32_t)size, vm->charCap, 1) ) {
+		return NO_STRING;
 	}
-	vm->chars[vm->charCount]    = '\0';
-	++vm->charCount;
+	memcpy(&vm->chars[strIdx], str, size);
+	vm->charCount   += (uint32_t)size;
 	return strIdx;
 }
 
+//
+// a named function is also appended to the dictionary, an anonymous one (NULL
+// name) only takes its function entry
+// Return: the function index, VM_NO_FUNCTION if a segment is full (see flags)
+//
+static
+uint32_t
+addFunction(VM* vm, Function f, const char* name, ExceptFlags* flags) {
+	if( !growSegment(vm, vm->funcCount, 1, vm->funCap, sizeof(Function)) ) {
+		flags->indiv.fnOF   = true;
+		return VM_NO_FUNCTION;
+	}
+	f.nameOffset    = VM_NO_NAME;
+	if( name && (f.nameOffset = addConstString(vm, name)) == NO_STRING ) {
+		flags->indiv.chOF   = true;
+		return VM_NO_FUNCTION;
+	}
+	uint32_t    fidx    = vm->funcCount;
+	vm->funcs[fidx] = f;
+	++vm->funcCount;
+	if( name ) {
+		// fits, there are no more words than functions
+		growSegment(vm, vm->wordCount, 1, vm->funCap, sizeof(uint32_t));
+		vm->words[vm->wordCount++]  = fidx;
+	}
+	return fidx;
+}
 
 void
 vmPushString(Process* proc, const char* str) {
@@ -284,26 +480,32 @@ vmTopString(Process* proc) {
 //
 uint32_t
 vmFindFunction(VM* vm, const char* str) {
-	for(uint32_t fidx = vm->funcCount; fidx > 0; --fidx) {
-		if(strcmp(str, &vm->chars[vm->funcs[fidx - 1].nameOffset]) == 0) {
-			return fidx;
+	for(uint32_t w = vm->wordCount; w > 0; --w) {
+		uint32_t    fidx    = vm->words[w - 1];
+		if(strcmp(str, &vm->chars[vm->funcs[fidx].nameOffset]) == 0) {
+			return fidx + 1;
 		}
 	}
 	return 0;
 }
 
+const char*
+vmFunctionName(const VM* vm, uint32_t fidx, char buf[VM_NAME_SIZE]) {
+	if( vm->funcs[fidx].nameOffset != VM_NO_NAME ) {
+		return &vm->chars[vm->funcs[fidx].nameOffset];
+	}
+	snprintf(buf, VM_NAME_SIZE, "lambda#%u", fidx);
+	return buf;
+}
+
 uint32_t
-vmAllocateInterpFunction(VM* vm, const char* str) {
+vmAllocateInterpFunction(Process* proc, const char* str) {
 	Function    f   = {
 		.type           = FT_INTERP,
 		.isImmediate    = false,
-		.nameOffset     = addConstString(vm, str),
 		.u              = { .interp = { .insOffset = 0, .insCount = 0 } }
 	};
-	uint32_t    fidx    = vm->funcCount;
-	vm->funcs[vm->funcCount]    = f;
-	++vm->funcCount;
-	return fidx;
+	return addFunction(proc->vm, f, str, &proc->exceptFlags);
 }
 
 uint32_t
@@ -311,16 +513,12 @@ vmAddNativeFunction(VM* vm, const char* str, bool isImmediate, NativeFunction na
 	Function    f   = {
 		.type           = FT_NATIVE,
 		.isImmediate    = isImmediate,
-		.nameOffset     = addConstString(vm, str),
 		.u              = { .native = native },
 		.inVS           = inVS,
 		.outVS          = outVS
 	};
-
-	uint32_t    fidx    = vm->funcCount;
-	vm->funcs[vm->funcCount]    = f;
-	++vm->funcCount;
-	return fidx;
+	ExceptFlags flags   = { .all = 0 };
+	return addFunction(vm, f, str, &flags);
 }
 
 void
@@ -331,10 +529,19 @@ vmFetch(Process* proc) {
 
 	assert(fp < vm->funcCount);
 
-	const char* fName   = &vm->chars[vm->funcs[fp].nameOffset];
-#ifdef LOG_LEVEL_0
-	log("in %s - %d | %d :", fName, fp, ip);
+#if defined(LOG_LEVEL_0) && !defined(NDEBUG)  // names are only built for the log
+	char        nameBuf[VM_NAME_SIZE];
+	log("in %s - %d | %d :", vmFunctionName(vm, fp, nameBuf), fp, ip);
 #endif
+	if( vm->funcs[fp].type == FT_LAZY ) {
+		vmModuleMaterialize(vm, fp, &proc->exceptFlags);
+		if( proc->exceptFlags.all ) {
+			interruptSlice();
+		}
+	}
+	// pairs with the release fence of vmModuleMaterialize, the body is
+	// written before the type
+	atomic_thread_fence(memory_order_acquire);
 	Function    func        = vm->funcs[fp];
 	uint32_t    fpInsCount  = ( func.type == FT_INTERP ) ? func.u.interp.insCount : 0;
 	proc->fetchState.doReturn = ( ip >= fpInsCount );
@@ -367,10 +574,20 @@ vmSetTailCall(Process* proc, uint32_t word) {
 	proc->ip                    = 0;
 }
 
+static Generator*   newGenerator    (Process* proc, Value lambda);
+static void         resumeGenerator (Process* proc, Generator* gen);
+static void         yieldGenerator  (Process* proc, Value v);
+static void         finishGenerator (Process* proc);
+static void         releaseGenerator(Process* proc, Generator* gen);
+
 void
 vmExecute(Process* proc) {
 	VM*     vm  = proc->vm;
 	if( proc->fetchState.doReturn ) {
+		if( proc->rsCount == 0 ) {
+			finishGenerator(proc);  // only a generator runs without a return frame
+			return;
+		}
 		popReturn(proc);    // ip exceeds instruction count, return
 #ifdef LOG_LEVEL_0
 		log("ret to %d:%d | rs count: %d\n", proc->fp, proc->ip, proc->rsCount);
@@ -389,8 +606,9 @@ vmExecute(Process* proc) {
 #endif
 		pushValue(proc, U32V(operand));
 	} else { // OP_CALL
-#ifdef LOG_LEVEL_0
-		const char* fName       = &vm->chars[vm->funcs[operand].nameOffset];
+#if defined(LOG_LEVEL_0) && !defined(NDEBUG)
+		char        nameBuf[VM_NAME_SIZE];
+		const char* fName       = vmFunctionName(vm, operand, nameBuf);
 #endif
 		uint32_t    argCount    = vm->funcs[operand].inVS;
 
@@ -437,6 +655,7 @@ vmExecute(Process* proc) {
 		switch( operand ) {
 
 		case OP_NOP:        break;
+		case OP_DROP:       break;
 		case OP_DUP:
 			pushValue(proc, proc->readState.s0);
 			pushValue(proc, proc->readState.s0);
@@ -489,29 +708,84 @@ vmExecute(Process* proc) {
 			if( !isTail ) {
 				pushReturn(proc);   // normal call: push return value
 			}
-			if( proc->readState.s0.u32 != 0 ) {
-				proc->fp    = proc->readState.s1.u32;
-			} else {
-				proc->fp    = proc->readState.s2.u32;
-			}
-
+			proc->fp    = enterCallable(proc, proc->readState.s0.u32 != 0 ? proc->readState.s1 : proc->readState.s2);
 			proc->ip = 0;
+			countReduction(proc);
 			break;
 
-		case OP_CALL_IND:   proc->fp    = proc->readState.s0.u32; proc->ip  = 0;        break;
+		case OP_CALL_IND:
+			if( !isTail ) {
+				pushReturn(proc);   // normal call: push return value
+			}
+			proc->fp    = enterCallable(proc, proc->readState.s0);
+			proc->ip    = 0;
+			countReduction(proc);
+			break;
 
 		case OP_PUSH_LOCAL: pushLocal(proc, proc->readState.s0);                        break;
 		case OP_READ_LOCAL: pushValue(proc, getLocalValue(proc, proc->readState.s0.u32));   break;
 
-		case OP_YIELD:  proc->exceptFlags.indiv.yF  = true; break;
+		// the count, the lambda and the capture index come from the script
+		case OP_CLOSURE:
+			if( proc->readState.s0.u32 > proc->vsCount ) {
+				proc->exceptFlags.indiv.vsUF    = true;
+				interruptSlice();
+			} else if( vmIsClosure(proc->readState.s1) || proc->readState.s1.u64 >= vm->funcCount ) {
+				proc->exceptFlags.indiv.cloF    = true;
+				interruptSlice();
+			} else {
+				pushValue(proc, newClosure(proc, proc->readState.s1.u32, proc->readState.s0.u32));
+			}
+			break;
+		case OP_READ_CAPTURE:
+			if( proc->closure == NULL || proc->readState.s0.u32 >= proc->closure->count ) {
+				proc->exceptFlags.indiv.cloF    = true;
+				interruptSlice();
+			} else {
+				pushValue(proc, proc->closure->values[proc->readState.s0.u32]);
+			}
+			break;
+		case OP_FREE_CLOSURE:
+			if( vmIsClosure(proc->readState.s0) ) {
+				unmapBuffer(proc, vmClosureOf(proc->readState.s0));
+			}
+			break;
+
+		case OP_GEN_NEW:
+			if( !vmIsClosure(proc->readState.s0) && proc->readState.s0.u64 >= vm->funcCount ) {
+				proc->exceptFlags.indiv.cloF    = true;
+				interruptSlice();
+			} else {
+				pushValue(proc, (Value) { .ref = newGenerator(proc, proc->readState.s0) });
+			}
+			break;
+		case OP_GEN_NEXT:   resumeGenerator(proc, proc->readState.s0.ref); countReduction(proc);        break;
+		case OP_GEN_YIELD:  yieldGenerator(proc, proc->readState.s0);                                   break;
+		case OP_GEN_FREE:   releaseGenerator(proc, proc->readState.s0.ref);                             break;
 
-		case OP_MAP:    pushValue(proc, (Value) { .ref = calloc(proc->readState.s0.u32, 1) });  break;
-		case OP_UNMAP:  free(proc->readState.s0.ref);   break;
-        case OP_TRY_SEND:   break; /* TODO */
-        case OP_TRY_RECV:   break; /* TODO */
-        case OP_SPAWN: /* TODO */
-		case OP_PID: /* TODO */
+		case OP_YIELD:  proc->exceptFlags.indiv.yF  = true; interruptSlice();   break;
+
+		case OP_MAP:    pushValue(proc, (Value) { .ref = mapBuffer(proc, proc->readState.s0.u32) });  break;
+		case OP_UNMAP:  unmapBuffer(proc, proc->readState.s0.ref);  break;
+        case OP_TRY_SEND:
+			pushValue(proc, U32V(vmSend(vm, proc, proc->readState.s2.u64, proc->readState.s0.ref, proc->readState.s1.u32)));
+			break;
+        case OP_TRY_RECV: {
+			Message msg     = { .addr = NULL, .size = 0 };
+			bool    isRecv  = vmReceive(proc, &msg);
+			pushValue(proc, (Value) { .ref = msg.addr });
+			pushValue(proc, U32V(msg.size));
+			pushValue(proc, U32V(isRecv));
+			break;
+		}
+        case OP_SPAWN: {
+			// a closure belongs to its process, only a lambda is spawned
+			Process*    child   = vmIsClosure(proc->readState.s1) ? NULL
+			                    : vmSpawn(vm, (ProcPtr){ .ptr = (uint32_t)proc->pid }, proc->readState.s1.u32, proc->readState.s0.u32, proc->priority);
+			pushValue(proc, (Value) { .u64 = child ? child->pid : 0 });
 			break;
+		}
+		case OP_PID:    pushValue(proc, (Value) { .u64 = proc->pid }); break;
 
         case OP_VS:     pushValue(proc, U32V(proc->vsCount)); break;
         case OP_RS:     pushValue(proc, U32V(proc->rsCount)); break;
@@ -521,7 +795,13 @@ vmExecute(Process* proc) {
 #ifdef LOG_LEVEL_0
 				log("\t[%d] <%s>\n", proc->vsCount, fName);
 #endif
+				sigjmp_buf* jump    = interruptJump;
+				interruptJump       = NULL;
 				vm->funcs[operand].u.native(proc);
+				interruptJump       = jump;
+				if( proc->exceptFlags.all ) {
+					interruptSlice();
+				}
 			} else {
 				if( !isTail ) {
 #ifdef LOG_LEVEL_0
@@ -539,6 +819,7 @@ vmExecute(Process* proc) {
 #endif
 				proc->fp    = operand;
 				proc->ip    = 0;
+				countReduction(proc);
 			}
 			}
 		}
@@ -551,23 +832,167 @@ vmNext(Process* proc) {
 	vmExecute   (proc);
 }
 
+//
+// stack overflows are trapped by the guard pages instead of checked on every
+// push: the fault handler flags the process running on the faulting thread and
+// jumps back to its vmRunSlice, the process is then killed like for any other
+// exception (which leaves the slice the same way, through interruptJump). A fault on the closed part of a stack window opens more of it
+// instead. Faults outside of a process stack keep the default action.
+//
+static _Thread_local Process*       runningProcess  = NULL;
+static _Thread_local sigjmp_buf*    faultJump       = NULL;
+
+static
+void
+onStackFault(int sig, siginfo_t* info, void* context) {
+	(void)sig;
+	(void)context;
+	Process*    proc    = runningProcess;
+	uint8_t*    addr    = (uint8_t*)info->si_addr;
+	uint8_t*    arena   = proc ? (uint8_t*)proc->arena : NULL;
+	// a running generator has value and return stacks of its own
+	uint8_t*    genArena= proc && proc->gen ? (uint8_t*)proc->gen->arena : NULL;
+	bool        isStack = proc && ((addr >= arena && addr < arena + proc->arenaSize)
+	                           || (genArena && addr >= genArena && addr < genArena + proc->gen->arenaSize));
+
+	if( faultJump == NULL || !isStack ) {
+		signal(SIGSEGV, SIG_DFL);   // the faulting access is replayed and kills the VM
+		return;
+	}
+
+	for( uint32_t k = 0; k < SK_COUNT; ++k ) {
+		StackWindow*    w   = &proc->windows[k];
+		if( addr >= w->start && addr < w->start + w->size ) {
+			// closed part of the stack: open at least twice as much and replay
+			size_t  need    = pageAlign(proc->vm, (size_t)(addr - w->start) + 1);
+			size_t  open    = 2 * w->open > need ? 2 * w->open : need;
+			open    = open < w->size ? open : w->size;
+			if( mprotect(w->start + w->open, open - w->open, PROT_READ | PROT_WRITE) == 0 ) {
+				w->open = open;
+				return;
+			}
+		}
+
+		if( addr >= w->start && addr < w->start + w->size + proc->vm->pageSize ) {
+			// guard page (or no mapping left to grow)
+			switch( k ) {
+			case SK_VALUE:  proc->exceptFlags.indiv.vsOF    = true; break;
+			case SK_RETURN: proc->exceptFlags.indiv.rsOF    = true; break;
+			case SK_LOCAL:  proc->exceptFlags.indiv.lsOF    = true; break;
+			}
+			siglongjmp(*faultJump, 1);
+		}
+	}
+
+	signal(SIGSEGV, SIG_DFL);   // string stack, not guarded
+}
+
+static
+void
+installStackFaultHandler() {
+	struct sigaction    action;
+	memset(&action, 0, sizeof(action));
+	// not deferred: the handler leaves through siglongjmp without restoring the mask
+	action.sa_sigaction = onStackFault;
+	action.sa_flags     = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, NULL);
+}
+
+bool
+vmRunSlice(Process* proc, uint32_t rsBase) {
+	VM*         vm          = proc->vm;
+	Process*    outerProc   = runningProcess;   // slices nest through the repl (load)
+	sigjmp_buf* outerJump   = faultJump;
+	sigjmp_buf* outerInterrupt  = interruptJump;
+	sigjmp_buf  onFault;
+	bool        isDone      = true;
+
+	if( sigsetjmp(onFault, 0) == 0 ) {
+		runningProcess  = proc;
+		faultJump       = &onFault;
+		interruptJump   = &onFault;
+		if( proc->exceptFlags.all ) {
+			interruptSlice();   // raised by a native invoked directly (repl)
+		}
+		// the only branch per instruction is the one of the loop, exceptions jump out
+		while( !vm->quit && (proc->rsCount > rsBase || proc->gen) ) {
+			vmNext(proc);
+		}
+	} else {
+		isDone  = false;    // exception or overflow, the flag is set
+	}
+
+	runningProcess  = outerProc;
+	faultJump       = outerJump;
+	interruptJump   = outerInterrupt;
+	return isDone;
+}
+
+void
+vmSetReductionBudget(Process* proc, uint32_t budget) {
+	budget  = budget ? budget : 1;
+	proc->reductionBudget   = budget;
+	proc->reductions        = budget;
+}
+
+
+void*
+vmReserve(size_t size) {
+	void*   addr    = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+void
+vmUnreserve(void* addr, size_t size) {
+	if( addr ) {
+		munmap(addr, size);
+	}
+}
+
+// Return: bytes of the tables reserved by vmNew and of the segments grown so far
+static
+int64_t
+segmentBytes(const VM* vm) {
+	return (int64_t)(sizeof(VM)
+	     + pageAlign(vm, vm->funcCount * sizeof(Function))
+	     + pageAlign(vm, vm->wordCount * sizeof(uint32_t))
+	     + pageAlign(vm, vm->insCount  * sizeof(uint32_t))
+	     + pageAlign(vm, vm->charCount)
+	     + pageAlign(vm, vm->relocCount * sizeof(uint32_t))
+	     + vm->strmCap  * sizeof(Stream*)
+	     + vm->procCap  * sizeof(Process)
+	     + vm->compilerState.cfsCap * sizeof(CompiledFunctionEntry)
+	     + vm->compilerState.cisCap * sizeof(uint32_t) * 2);
+}
 
 VM*
 vmNew(const VMParameters* params)
 {
 	VM* vm  = (VM*)calloc(1, sizeof(VM));
 
-	vm->funCap  = params->maxFunctionCount;
-	vm->insCap  = params->maxInstructionCount;
-	vm->charCap = params->maxCharSegmentSize;
+	vm->funCap  = params->maxFunctionCount      ? params->maxFunctionCount      : VM_MAX_FUNCTIONS;
+	vm->insCap  = params->maxInstructionCount   ? params->maxInstructionCount   : VM_MAX_INSTRUCTIONS;
+	vm->charCap = params->maxCharSegmentSize    ? params->maxCharSegmentSize    : VM_MAX_CHARS;
 	vm->strmCap = params->maxFileCount;
     vm->procCap = params->maxProcCount;
-
-	vm->funcs       = (Function*)   calloc(params->maxFunctionCount,    sizeof(Function));
-	vm->ins         = (uint32_t*)   calloc(params->maxInstructionCount, sizeof(uint32_t));
-	vm->chars       = (char*)       calloc(params->maxCharSegmentSize,  1);
-	vm->strms       = (Stream**)    calloc(params->maxFileCount,        sizeof(Stream*));
-    vm->procs       = (Process*)    calloc(params->maxProcCount,        sizeof(Process));
+	vm->pageSize    = (size_t)sysconf(_SC_PAGESIZE);
+	pthread_mutex_init(&vm->codeLock, NULL);
+	installStackFaultHandler();
+
+	// the segments are sized for their caps but only backed as they fill up
+	vm->funcs       = (Function*)   vmReserve((size_t)vm->funCap                    * sizeof(Function));
+	vm->words       = (uint32_t*)   vmReserve((size_t)vm->funCap                    * sizeof(uint32_t));
+	vm->ins         = (uint32_t*)   vmReserve((size_t)vm->insCap                    * sizeof(uint32_t));
+	vm->chars       = (char*)       vmReserve((size_t)vm->charCap);
+	vm->relocs      = (uint32_t*)   vmReserve((size_t)vm->insCap                    * sizeof(uint32_t));
+	vm->strms       = (Stream**)    vmReserve((size_t)params->maxFileCount          * sizeof(Stream*));
+	vm->procs       = (Process*)    vmReserve((size_t)params->maxProcCount          * sizeof(Process));
+#ifdef MADV_HUGEPAGE
+	if( params->hugeCodePages ) {
+		madvise(vm->ins, (size_t)vm->insCap * sizeof(uint32_t), MADV_HUGEPAGE);
+	}
+#endif
 
 	Stream*     errS    = vmStreamFromFile(vm, stderr, SM_WO);
 	Stream*     outS    = vmStreamFromFile(vm, stdout, SM_WO);
@@ -578,38 +1003,257 @@ vmNew(const VMParameters* params)
 	vmStreamPush(vm, inS);
 
 
-	vm->compilerState.cfs       = (CompiledFunctionEntry*)calloc(params->maxCFCount, sizeof(CompiledFunctionEntry));
+	vm->compilerState.cfs       = (CompiledFunctionEntry*)vmReserve((size_t)params->maxCFCount * sizeof(CompiledFunctionEntry));
 	vm->compilerState.cfsCap    = params->maxCFCount;
 
-	vm->compilerState.cis       = (uint32_t*)calloc(params->maxCISCount, sizeof(uint32_t));
+	vm->compilerState.cis       = (uint32_t*)vmReserve((size_t)params->maxCISCount * sizeof(uint32_t));
 	vm->compilerState.cisCap    = params->maxCISCount;
+	vm->compilerState.refs      = (uint32_t*)vmReserve((size_t)params->maxCISCount * sizeof(uint32_t));
+	vm->reportLeaks             = params->reportLeaks;
+	vmMemTrack(NULL, MEM_SEGMENTS, segmentBytes(vm));
 
 	for(uint32_t i = 0; i < sizeof(opcodes) / sizeof(Opcode); ++i) {
 		vmAddNativeFunction(vm, opcodes[i].name, false, 0, opcodes[i].inVs, opcodes[i].outVs);
 	}
 
 	vmRegisterStdWords(vm);
+
+	vmSchedulerStart(vm, params->workerCount);
 	return vm;
 }
 
 void
 vmRelease(VM* vm) {
-	free(vm->funcs);
-	free(vm->ins);
-	free(vm->chars);
+	vmSchedulerStop(vm);
+	vmMemTrack(NULL, MEM_SEGMENTS, -segmentBytes(vm));
+	vmModuleReleaseAll(vm);
+	pthread_mutex_destroy(&vm->codeLock);
+
+	vmUnreserve(vm->funcs, (size_t)vm->funCap  * sizeof(Function));
+	vmUnreserve(vm->words, (size_t)vm->funCap  * sizeof(uint32_t));
+	vmUnreserve(vm->ins,   (size_t)vm->insCap  * sizeof(uint32_t));
+	vmUnreserve(vm->chars, (size_t)vm->charCap);
+	vmUnreserve(vm->relocs,(size_t)vm->insCap  * sizeof(uint32_t));
 
 	uint32_t    strmCount  = vm->strmCount;
 	for( uint32_t i = 0; i < strmCount; ++i ) {
 		vmStreamPop(vm);
 	}
-	free(vm->strms);
+	vmUnreserve(vm->strms, (size_t)vm->strmCap * sizeof(Stream*));
 
-	free(vm->compilerState.cfs);
-	free(vm->compilerState.cis);
+	vmUnreserve(vm->compilerState.cfs, (size_t)vm->compilerState.cfsCap * sizeof(CompiledFunctionEntry));
+	vmUnreserve(vm->compilerState.cis, (size_t)vm->compilerState.cisCap * sizeof(uint32_t));
+	vmUnreserve(vm->compilerState.refs, (size_t)vm->compilerState.cisCap * sizeof(uint32_t));
 
     // TODO: destroy all processes
-    free(vm->procs);
+	vmUnreserve(vm->procs, (size_t)vm->procCap * sizeof(Process));
+
+	bool    reportLeaks = vm->reportLeaks;
 	free(vm);
+
+	MemStats    stats;
+	if( reportLeaks && MemStats_collect(&stats) ) {
+		for( uint32_t c = 0; c < MEM_CATEGORY_COUNT; ++c ) {
+			if( stats.current[c] != 0 ) {
+				fprintf(stderr, "Leak: %s %ld bytes (%lu allocations, %lu releases)\n", MemCategory_names[c],
+				        (long)stats.current[c], (unsigned long)stats.allocs[c], (unsigned long)stats.frees[c]);
+			}
+		}
+	}
+}
+
+//
+// place a stack of size bytes so that it ends at the guard page following it,
+// the whole stack is open. The protection fails once vm.max_map_count is
+// reached, there is no safe way to run the process then
+//
+static
+void*
+carveStack(const VM* vm, uint8_t** base, size_t size, StackWindow* w) {
+	uint8_t*    guard   = *base + pageAlign(vm, size);
+	if( mprotect(guard, vm->pageSize, PROT_NONE) != 0 ) {
+		return NULL;
+	}
+	w->start    = *base;
+	w->size     = (size_t)(guard - *base);
+	w->open     = w->size;
+	*base   = guard + vm->pageSize;
+	return guard - size;
+}
+
+//
+// close the pages of each guarded stack that are far above its top and give
+// them back to the system. A window is only trimmed when it is at least 4 times
+// what is in use and keeps twice that, so a process hovering around a page
+// boundary does not fault and trim over and over
+//
+void
+vmTrimStacks(Process* proc) {
+	const VM*   vm      = proc->vm;
+	uint8_t*    tops[SK_COUNT]  = {
+		[SK_VALUE]  = (uint8_t*)(proc->vs + proc->vsCount),
+		[SK_RETURN] = (uint8_t*)(proc->rs + proc->rsCount),
+		[SK_LOCAL]  = (uint8_t*)(proc->ls + proc->lsCount),
+	};
+
+	for( uint32_t k = 0; k < SK_COUNT; ++k ) {
+		StackWindow*    w       = &proc->windows[k];
+		size_t          used    = (size_t)(tops[k] - w->start);
+		size_t          keep    = pageAlign(vm, 2 * used > vm->pageSize ? 2 * used : vm->pageSize);
+		if( 2 * keep <= w->open ) {
+			madvise(w->start + keep, w->open - keep, MADV_DONTNEED);
+			mprotect(w->start + keep, w->open - keep, PROT_NONE);
+			w->open = keep;
+		}
+	}
+}
+
+#define SWAP_FIELD(A, B)    { __typeof__(A) t = (A); (A) = (B); (B) = t; }
+
+//
+// the process continues on the stacks and at the position kept in gen, which
+// keeps the ones it leaves. The same swap enters and leaves a generator
+//
+INLINE
+void
+switchGenerator(Process* proc, Generator* gen) {
+	SWAP_FIELD(proc->vs,        gen->vs);
+	SWAP_FIELD(proc->vsCount,   gen->vsCount);
+	SWAP_FIELD(proc->vsCap,     gen->vsCap);
+	SWAP_FIELD(proc->rs,        gen->rs);
+	SWAP_FIELD(proc->rsCount,   gen->rsCount);
+	SWAP_FIELD(proc->rsCap,     gen->rsCap);
+	SWAP_FIELD(proc->windows[SK_VALUE],     gen->windows[SK_VALUE]);
+	SWAP_FIELD(proc->windows[SK_RETURN],    gen->windows[SK_RETURN]);
+	SWAP_FIELD(proc->fp,        gen->pos.fp);
+	SWAP_FIELD(proc->ip,        gen->pos.ip);
+	SWAP_FIELD(proc->lp,        gen->pos.lp);
+	SWAP_FIELD(proc->closure,   gen->pos.closure);
+}
+
+// back to the resumer of the running generator
+INLINE
+Generator*
+leaveGenerator(Process* proc) {
+	Generator*  gen = proc->gen;
+	switchGenerator(proc, gen);
+	proc->gen       = gen->resumer;
+	gen->isRunning  = false;
+	return gen;
+}
+
+//
+// the stacks are guarded like the process ones, an overflow kills the process
+// Return: NULL if the stacks cannot be mapped
+//
+static
+Generator*
+newGenerator(Process* proc, Value lambda) {
+	const VM*   vm          = proc->vm;
+	size_t      vsSize      = GEN_VALUE_COUNT  * sizeof(Value);
+	size_t      rsSize      = GEN_RETURN_COUNT * sizeof(Return);
+	size_t      arenaSize   = pageAlign(vm, vsSize) + pageAlign(vm, rsSize) + 2 * vm->pageSize;
+	Generator*  gen         = Slab_alloc(sizeof(Generator));
+	if( gen == NULL ) {
+		return NULL;
+	}
+
+	memset(gen, 0, sizeof(Generator));
+	gen->arena  = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	uint8_t*    base    = (uint8_t*)gen->arena;
+	if( gen->arena == MAP_FAILED
+	 || (gen->vs = carveStack(vm, &base, vsSize, &gen->windows[SK_VALUE])) == NULL
+	 || (gen->rs = carveStack(vm, &base, rsSize, &gen->windows[SK_RETURN])) == NULL ) {
+		if( gen->arena != MAP_FAILED ) {
+			munmap(gen->arena, arenaSize);
+		}
+		Slab_free(gen);
+		return NULL;
+	}
+
+	// the lambda starts without a return frame, returning from it ends the generator
+	bool        isClosure   = vmIsClosure(lambda);
+	gen->arenaSize  = arenaSize;
+	gen->vsCap      = GEN_VALUE_COUNT;
+	gen->rsCap      = GEN_RETURN_COUNT;
+	gen->pos        = (Return) {
+		.fp         = isClosure ? vmClosureOf(lambda)->func : lambda.u32,
+		.ip         = 0,
+		.lp         = proc->lp,
+		.closure    = isClosure ? vmClosureOf(lambda) : NULL,
+	};
+
+	gen->next   = proc->gens;
+	if( proc->gens ) {
+		proc->gens->prev    = gen;
+	}
+	proc->gens  = gen;
+	vmMemTrack(proc, MEM_STACKS, (int64_t)(arenaSize + Slab_size(gen)));
+	return gen;
+}
+
+// a generator that is done, running (itself or a resumer) or missing returns 0 0
+static
+void
+resumeGenerator(Process* proc, Generator* gen) {
+	if( gen == NULL || gen->isRunning || gen->isDone ) {
+		pushValue(proc, U32V(0));
+		pushValue(proc, U32V(0));
+		return;
+	}
+
+	gen->resumer    = proc->gen;
+	gen->isRunning  = true;
+	proc->gen       = gen;
+	switchGenerator(proc, gen);
+}
+
+// outside of a generator the value is dropped
+static
+void
+yieldGenerator(Process* proc, Value v) {
+	if( proc->gen ) {
+		leaveGenerator(proc);
+		pushValue(proc, v);
+		pushValue(proc, U32V(1));
+	}
+}
+
+static
+void
+finishGenerator(Process* proc) {
+	assert(proc->gen != NULL);
+	leaveGenerator(proc)->isDone    = true;
+	pushValue(proc, U32V(0));
+	pushValue(proc, U32V(0));
+}
+
+// a running generator is left alone
+static
+void
+releaseGenerator(Process* proc, Generator* gen) {
+	if( gen == NULL || gen->isRunning ) {
+		return;
+	}
+
+	if( gen->prev ) {
+		gen->prev->next = gen->next;
+	} else {
+		proc->gens      = gen->next;
+	}
+	if( gen->next ) {
+		gen->next->prev = gen->prev;
+	}
+	vmMemTrack(proc, MEM_STACKS, -(int64_t)(gen->arenaSize + Slab_size(gen)));
+	munmap(gen->arena, gen->arenaSize);
+	Slab_free(gen);
+}
+
+void
+vmGeneratorUnwind(Process* proc) {
+	while( proc->gen ) {
+		leaveGenerator(proc)->isDone    = true;
+	}
 }
 
 Process*
@@ -623,21 +1267,53 @@ vmNewProcess(VM* vm,
 			 uint32_t maxCharCount,
 			 uint32_t maxStringCount)
 {
-	Process*    proc    = (Process*)calloc(1, sizeof(Process));
+	Process*    proc    = &vm->procs[_this_.ptr];
+	uint64_t    gen     = (proc->pid >> 32) + 1;    // slots are reused, the generation keeps pids unique
+	memset(proc, 0, offsetof(Process, pins));
+
+	proc->pid   = (gen << 32) | _this_.ptr;
 	proc->lsCap = maxLocalCount;
 	proc->vsCap = maxValueCount;
 	proc->rsCap = maxReturnCount;
 
-	proc->vs        = (Value*)      calloc(maxValueCount,   sizeof(Value));
-	proc->ls        = (Value*)      calloc(maxLocalCount,   sizeof(Value));
-	proc->rs        = (Return*)     calloc(maxReturnCount,  sizeof(Return));
+	// all the stacks are carved from one anonymous mapping, hottest first. Pages
+	// are zero filled and committed on first touch so a process only pays for the
+	// stack depth it actually reaches. The value, return and local stacks end
+	// right at a guard page, an overflow faults on the first push past the
+	// capacity (see onStackFault). The string stack is only pushed by natives
+	// which check it, it does without guard (every guard costs 2 mappings)
+	size_t      vsSize      = (size_t)maxValueCount   * sizeof(Value);
+	size_t      rsSize      = (size_t)maxReturnCount  * sizeof(Return);
+	size_t      lsSize      = (size_t)maxLocalCount   * sizeof(Value);
+	size_t      stringsSize = pageAlign(vm, (size_t)maxStringCount * sizeof(uint32_t));
+	size_t      charsSize   = pageAlign(vm, (size_t)maxCharCount);
+
+	proc->arenaSize = pageAlign(vm, vsSize) + pageAlign(vm, rsSize) + pageAlign(vm, lsSize)
+	                + 3 * vm->pageSize + stringsSize + charsSize;
+	proc->arena     = mmap(NULL, proc->arenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	uint8_t*    base    = (uint8_t*)proc->arena;
+	if( proc->arena == MAP_FAILED
+	 || (proc->vs = carveStack(vm, &base, vsSize, &proc->windows[SK_VALUE])) == NULL
+	 || (proc->rs = carveStack(vm, &base, rsSize, &proc->windows[SK_RETURN])) == NULL
+	 || (proc->ls = carveStack(vm, &base, lsSize, &proc->windows[SK_LOCAL])) == NULL ) {
+		if( proc->arena != MAP_FAILED ) {
+			munmap(proc->arena, proc->arenaSize);
+		}
+		uint64_t    pid = proc->pid;
+		memset(proc, 0, offsetof(Process, pins));
+		proc->pid   = pid;
+		return NULL;
+	}
+	proc->ss.strings    = (uint32_t*)base;
+	proc->ss.chars      = (char*)(base + stringsSize);
+	vmMemTrack(proc, MEM_STACKS, (int64_t)proc->arenaSize);
 
-	proc->ss.chars      = (char*)calloc(maxCharCount, 1);
 	proc->ss.charCap    = maxCharCount;
-
-	proc->ss.strings    = (uint32_t*)calloc(maxStringCount, sizeof(uint32_t));
 	proc->ss.stringCap  = maxStringCount;
 
+	vmSetReductionBudget(proc, DEFAULT_REDUCTION_BUDGET);
+
     proc->vm        = vm;
     proc->parent    = parent;
 
@@ -651,23 +1327,73 @@ vmNewProcess(VM* vm,
 	return proc;
 }
 
+// undelivered shared buffers give their reference back
+static
+void
+dropMessage(Process* proc, Message* msg) {
+	if( msg->isShared ) {
+		Buffer_release(msg->addr);
+	}
+	vmMemTrack(proc, MEM_MESSAGES, -(int64_t)Slab_size(msg));
+	Slab_free(msg);
+}
+
 void
 vmReleaseProcess(Process* proc) {
     // TODO: destroy children processes
+	VM*         vm      = proc->vm;
+	uint64_t    pid     = proc->pid;
+
+	vmTimerCancel(vm, &proc->wait.timer);
+	vmTimerCancel(vm, &proc->ticker);
 
-	free(proc->vs);
-	free(proc->ls);
-	free(proc->rs);
+	vmGeneratorUnwind(proc);
+	while( proc->gens ) {
+		releaseGenerator(proc, proc->gens);
+	}
 
-	free(proc->ss.chars);
-	free(proc->ss.strings);
+	if( proc->arena ) {
+		vmMemTrack(proc, MEM_STACKS, -(int64_t)proc->arenaSize);
+		munmap(proc->arena, proc->arenaSize);
+	}
+	vmMemTrack(proc, MEM_REGIONS, -(int64_t)proc->region.mapped);
+	SlabRegion_release(&proc->region);
+
+	// no new sender gets in once the slot is closed, the ones already in are
+	// waited for so that their messages are dropped below
+	atomic_fetch_and_explicit(&proc->pins, ~PROC_OPEN, memory_order_acq_rel);
+	while( atomic_load_explicit(&proc->pins, memory_order_acquire) != 0 ) {
+		sched_yield();
+	}
 
-	free(proc);
+	if( proc->mailbox.elements ) {
+		vmMemTrack(proc, MEM_QUEUES, -vmMailboxBytes(proc));
+		void*       msgs[32];
+		uint32_t    count;
+		while( (count = BoundedQueue_popN(&proc->mailbox, msgs, 32)) != 0 ) {
+			for( uint32_t m = 0; m < count; ++m ) {
+				dropMessage(proc, msgs[m]);
+			}
+		}
+		BoundedQueue_release(&proc->mailbox);
+
+		// the slot is closed, no sender claims the link or pushes to the ring anymore
+		while( vmLinkBytes(proc) && (count = SpscQueue_popN(&proc->link.ring, msgs, 32)) != 0 ) {
+			for( uint32_t m = 0; m < count; ++m ) {
+				dropMessage(proc, msgs[m]);
+			}
+		}
+		SpscQueue_release(&proc->link.ring);
+	}
+
+	// keep the pid, its generation is bumped when the slot is reused. The pins
+	// of late senders are kept too, they back off until vmSpawn opens the slot
+	memset(proc, 0, offsetof(Process, pins));
+	proc->pid   = pid;
 }
 
 void
 vmPushValue(Process* proc, Value v) {
-	assert(proc->vsCount < proc->vsCap);
 	proc->vs[proc->vsCount] = v;
 	++proc->vsCount;
 }
@@ -681,7 +1407,7 @@ vmPopValue(Process* proc) {
 
 void
 vmPushReturn(Process* proc) {
-	Return r = { .fp = proc->fp, .ip = proc->ip, .lp = proc->lp };
+	Return r = { .fp = proc->fp, .ip = proc->ip, .lp = proc->lp, .closure = proc->closure };
 	proc->rs[proc->rsCount] = r;
 	++proc->rsCount;
 }
@@ -693,12 +1419,51 @@ vmPopReturn(Process* proc) {
 	proc->fp    = r.fp;
 	proc->ip    = r.ip;
 	proc->lp    = r.lp;
+	proc->closure   = r.closure;
 }
 
-void
-vmPushInstruction(VM* vm, uint32_t opcode) {
-	assert(vm->insCount < vm->insCap);
+bool
+vmReserveInstructions(VM* vm, uint32_t count, ExceptFlags* flags) {
+	if( !growSegment(vm, vm->insCount, count, vm->insCap, sizeof(uint32_t)) ) {
+		flags->indiv.insOF  = true;
+		return false;
+	}
+	return true;
+}
+
+bool
+vmPushInstruction(Process* proc, uint32_t opcode) {
+	VM*     vm  = proc->vm;
+	if( !vmReserveInstructions(vm, 1, &proc->exceptFlags) ) {
+		return false;
+	}
 	vm->ins[vm->insCount++] = opcode;
+	return true;
+}
+
+bool
+vmPushRelocation(VM* vm, uint32_t insOffset) {
+	assert(vm->relocCount == 0 || vm->relocs[vm->relocCount - 1] < insOffset);
+	if( !growSegment(vm, vm->relocCount, 1, vm->insCap, sizeof(uint32_t)) ) {
+		return false;
+	}
+	vm->relocs[vm->relocCount++]    = insOffset;
+	return true;
+}
+
+uint32_t
+vmFirstRelocation(const VM* vm, uint32_t insOffset) {
+	uint32_t    lo  = 0;
+	uint32_t    hi  = vm->relocCount;
+	while( lo < hi ) {
+		uint32_t    mid = lo + (hi - lo) / 2;
+		if( vm->relocs[mid] < insOffset ) {
+			lo  = mid + 1;
+		} else {
+			hi  = mid;
+		}
+	}
+	return lo;
 }
 
 void
@@ -707,15 +1472,38 @@ vmPopInstruction(VM* vm) {
 	--vm->insCount;
 }
 
+void
+vmPushCompilerLiteral(VM* vm, uint32_t value) {
+	if( value & OP_CALL ) {
+		// the high bit marks calls, it is set back at run time: low 1 31 u32.shl u32.or
+		vmPushCompilerInstruction(vm, value & OP_CALL_MASK);
+		vmPushCompilerInstruction(vm, 1);
+		vmPushCompilerInstruction(vm, 31);
+		vmPushCompilerInstruction(vm, OP_CALL | OP_U32_SHL);
+		vmPushCompilerInstruction(vm, OP_CALL | OP_U32_OR);
+	} else {
+		vmPushCompilerInstruction(vm, value);
+	}
+}
+
 void
 vmPushCompilerInstruction(VM* vm, uint32_t opcode) {
 	assert(vm->compilerState.cisCount < vm->compilerState.cisCap);
 	vm->compilerState.cis[vm->compilerState.cisCount++] = opcode;
 }
 
+void
+vmPushCompilerReference(VM* vm, uint32_t funcId) {
+	vm->compilerState.refs[vm->compilerState.refCount++]    = vm->compilerState.cisCount;
+	vmPushCompilerInstruction(vm, funcId);
+}
+
 void
 vmPopCompilerInstruction(VM* vm) {
 	assert(vm->compilerState.cisCount > 0);
 	--vm->compilerState.cisCount;
+	if( vm->compilerState.refCount && vm->compilerState.refs[vm->compilerState.refCount - 1] == vm->compilerState.cisCount ) {
+		--vm->compilerState.refCount;
+	}
 }
 
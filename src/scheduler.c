@@ -0,0 +1,531 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include "internals.h"
+
+static
+uint64_t
+monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t
+vmTicks(VM* vm) {
+	return (monotonicNs() - vm->sched.startNs) / SCHED_TICK_NS;
+}
+
+static
+void
+wakeWorker(Scheduler* sched) {
+	// pairs with the fence in parkWorker: either the worker sees the new process
+	// or we see the worker parked
+	atomic_thread_fence(memory_order_seq_cst);
+	if( atomic_load(&sched->parkedCount) != 0 ) {
+		pthread_mutex_lock(&sched->parkLock);
+		pthread_cond_signal(&sched->parkCond);
+		pthread_mutex_unlock(&sched->parkLock);
+	}
+}
+
+void
+vmSchedule(Process* proc) {
+	Scheduler*  sched   = &proc->vm->sched;
+	// every process is in at most one lane and the lanes can hold all the processes
+	bool        pushed  = BoundedQueue_push(&sched->runQueues[proc->priority], proc);
+	assert(pushed);
+	(void)pushed;
+	wakeWorker(sched);
+}
+
+static
+Process*
+pickProcess(Worker* w) {
+	Scheduler*  sched   = &w->vm->sched;
+	Process*    proc    = NULL;
+	uint32_t    start   = PP_HIGH;
+
+	++w->picks;
+	if( w->picks % SCHED_AGING_PERIOD == 0 ) {
+		// aging: rotate between the lower lanes
+		start   = 1 + (w->picks / SCHED_AGING_PERIOD) % (PP_COUNT - 1);
+	}
+
+	for( uint32_t i = 0; i < PP_COUNT; ++i ) {
+		uint32_t    lane    = (start + i) % PP_COUNT;
+		if( (proc = BoundedQueue_pop(&sched->runQueues[lane])) != NULL ) {
+			return proc;
+		}
+	}
+	return NULL;
+}
+
+//
+// advance the timer wheel when the next timer is due, only one worker does it
+// at a time, the others move on to their processes
+//
+static
+void
+fireTimers(Scheduler* sched, uint64_t now) {
+	if( now < atomic_load(&sched->nextExpiry) || pthread_mutex_trylock(&sched->timerLock) != 0 ) {
+		return;
+	}
+	TimerWheel_advance(&sched->timers, now);
+	atomic_store(&sched->nextExpiry, TimerWheel_nextExpiry(&sched->timers));
+	pthread_mutex_unlock(&sched->timerLock);
+}
+
+//
+// park until a process is scheduled or the next timer is due, the process list
+// is checked once more after announcing the worker as parked, a process may have
+// been scheduled in between
+//
+static
+Process*
+parkWorker(Worker* w) {
+	Scheduler*  sched   = &w->vm->sched;
+	Process*    proc    = NULL;
+
+	pthread_mutex_lock(&sched->parkLock);
+	atomic_fetch_add(&sched->parkedCount, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if( (proc = pickProcess(w)) == NULL && !atomic_load(&sched->stop) ) {
+		uint64_t    next    = atomic_load(&sched->nextExpiry);
+		if( next == TIMER_NEVER ) {
+			pthread_cond_wait(&sched->parkCond, &sched->parkLock);
+		} else {
+			uint64_t        deadline    = sched->startNs + next * SCHED_TICK_NS;
+			struct timespec ts          = { .tv_sec = (time_t)(deadline / 1000000000), .tv_nsec = (long)(deadline % 1000000000) };
+			pthread_cond_timedwait(&sched->parkCond, &sched->parkLock, &ts);
+		}
+	}
+
+	atomic_fetch_sub(&sched->parkedCount, 1);
+	pthread_mutex_unlock(&sched->parkLock);
+	return proc;
+}
+
+static
+void
+pushFreeSlot(Scheduler* sched, uint32_t slot) {
+	uint64_t    head    = atomic_load(&sched->freeHead);
+	uint64_t    next;
+	do {
+		atomic_store_explicit(&sched->freeLinks[slot], (uint32_t)head, memory_order_relaxed);
+		next    = (((head >> 32) + 1) << 32) | (slot + 1);
+	} while( !atomic_compare_exchange_weak(&sched->freeHead, &head, next) );
+}
+
+// Return: a free slot, 0 if all are in use (slot 0 is the root process)
+static
+uint32_t
+popFreeSlot(VM* vm) {
+	Scheduler*  sched   = &vm->sched;
+	uint64_t    head    = atomic_load(&sched->freeHead);
+	while( (uint32_t)head != 0 ) {
+		uint32_t    slot    = (uint32_t)head - 1;
+		uint64_t    next    = (((head >> 32) + 1) << 32) | atomic_load_explicit(&sched->freeLinks[slot], memory_order_relaxed);
+		if( atomic_compare_exchange_weak(&sched->freeHead, &head, next) ) {
+			return slot;
+		}
+	}
+
+	uint32_t    top     = atomic_load(&sched->slotTop);
+	while( top < vm->procCap ) {
+		if( atomic_compare_exchange_weak(&sched->slotTop, &top, top + 1) ) {
+			return top;
+		}
+	}
+	return 0;
+}
+
+static
+void
+exitProcess(Process* proc) {
+	VM*         vm      = proc->vm;
+	uint32_t    slot    = (uint32_t)proc->pid;
+	vmReleaseProcess(proc);
+	pushFreeSlot(&vm->sched, slot);
+}
+
+static
+void
+runProcess(Process* proc) {
+	ExceptFlags yieldOnly   = { .indiv = { .yF = true } };
+
+	atomic_store(&proc->state, PS_RUNNING);
+	proc->exceptFlags.indiv.yF  = false;
+	if( vmRunSlice(proc, 0) ) {
+		exitProcess(proc);              // returned from its entry function
+	} else if( proc->exceptFlags.all == yieldOnly.all ) {
+		uint32_t    running = PS_RUNNING;
+		if( proc->wait.requested ) {
+			proc->wait.requested    = false;
+			vmTrimStacks(proc);         // still ours until it is marked waiting
+			// fails if it was woken up in the mean time
+			if( atomic_compare_exchange_strong(&proc->state, &running, PS_WAITING) ) {
+				return;
+			}
+		}
+		atomic_store(&proc->state, PS_RUNNABLE);
+		vmSchedule(proc);               // descheduled, back to its lane
+	} else {
+		log("process %lu killed (flags: 0x%08X)\n", (unsigned long)proc->pid, proc->exceptFlags.all);
+		exitProcess(proc);
+	}
+}
+
+static
+void*
+workerMain(void* arg) {
+	Worker*     w       = (Worker*)arg;
+	Scheduler*  sched   = &w->vm->sched;
+
+	while( !atomic_load(&sched->stop) ) {
+		fireTimers(sched, vmTicks(w->vm));
+		Process*    proc    = pickProcess(w);
+		if( proc || (proc = parkWorker(w)) != NULL ) {
+			runProcess(proc);
+		}
+	}
+	return NULL;
+}
+
+void
+vmSchedulerStart(VM* vm, uint32_t workerCount) {
+	Scheduler*  sched   = &vm->sched;
+
+	for( uint32_t p = 0; p < PP_COUNT; ++p ) {
+		BoundedQueue_init(&sched->runQueues[p], vm->procCap);
+	}
+
+	// slot 0 is the root process
+	sched->freeLinks    = vmReserve((size_t)vm->procCap * sizeof(uint32_t));
+	atomic_store(&sched->freeHead, 0);
+	atomic_store(&sched->slotTop, 1);
+
+	pthread_condattr_t  attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&sched->parkLock, NULL);
+	pthread_cond_init(&sched->parkCond, &attr);
+	pthread_condattr_destroy(&attr);
+	atomic_store(&sched->parkedCount, 0);
+	atomic_store(&sched->stop, false);
+
+	sched->startNs  = monotonicNs();
+	pthread_mutex_init(&sched->timerLock, NULL);
+	TimerWheel_init(&sched->timers, 0);
+	atomic_store(&sched->nextExpiry, TIMER_NEVER);
+
+	sched->workerCount  = workerCount;
+	sched->workers      = (Worker*)calloc(workerCount, sizeof(Worker));
+	for( uint32_t i = 0; i < workerCount; ++i ) {
+		sched->workers[i].vm    = vm;
+		sched->workers[i].id    = i;
+		pthread_create(&sched->workers[i].thread, NULL, workerMain, &sched->workers[i]);
+	}
+}
+
+void
+vmSchedulerStop(VM* vm) {
+	Scheduler*  sched   = &vm->sched;
+
+	atomic_store(&sched->stop, true);
+	pthread_mutex_lock(&sched->parkLock);
+	pthread_cond_broadcast(&sched->parkCond);
+	pthread_mutex_unlock(&sched->parkLock);
+
+	for( uint32_t i = 0; i < sched->workerCount; ++i ) {
+		pthread_join(sched->workers[i].thread, NULL);
+	}
+	free(sched->workers);
+
+	// release the processes that never got to finish (runnable or waiting)
+	uint32_t    slotTop = atomic_load(&sched->slotTop);
+	for( uint32_t slot = 1; slot < slotTop; ++slot ) {
+		if( vm->procs[slot].vm ) {
+			vmReleaseProcess(&vm->procs[slot]);
+		}
+	}
+	for( uint32_t p = 0; p < PP_COUNT; ++p ) {
+		BoundedQueue_release(&sched->runQueues[p]);
+	}
+	vmUnreserve(sched->freeLinks, (size_t)vm->procCap * sizeof(uint32_t));
+
+	pthread_cond_destroy(&sched->parkCond);
+	pthread_mutex_destroy(&sched->parkLock);
+	pthread_mutex_destroy(&sched->timerLock);
+}
+
+Process*
+vmSpawn(VM* vm, ProcPtr parent, uint32_t lambda, uint32_t mailboxCap, ProcPriority priority) {
+	// the lambda comes from a script, anything but a word or a lambda is refused
+	if( lambda >= vm->funcCount || vm->funcs[lambda].type == FT_NATIVE ) {
+		return NULL;
+	}
+
+	uint32_t    slot    = popFreeSlot(vm);
+	if( slot == 0 ) {
+		return NULL;
+	}
+
+	Process*    pp      = &vm->procs[parent.ptr];
+	Process*    proc    = vmNewProcess(vm, (ProcPtr){ .ptr = slot }, parent, (ProcPtr){ .ptr = (uint32_t)-1 },
+	                                   pp->vsCap, pp->lsCap, pp->rsCap, pp->ss.charCap, pp->ss.stringCap);
+	if( proc == NULL ) {
+		pushFreeSlot(&vm->sched, slot);
+		return NULL;
+	}
+
+	// spawned processes only run in slices where stack faults are handled, start
+	// them with a page per stack
+	vmTrimStacks(proc);
+
+	proc->priority  = priority;
+	vmSetReductionBudget(proc, pp->reductionBudget);
+	proc->useRegion = pp->useRegion;
+	if( mailboxCap ) {
+		BoundedQueue_init(&proc->mailbox, mailboxCap);
+		vmMemTrack(proc, MEM_QUEUES, vmMailboxBytes(proc));
+		atomic_fetch_or_explicit(&proc->pins, PROC_OPEN, memory_order_release);
+	}
+
+	// returning from the entry function pops this frame and ends the process
+	proc->fp    = 0;
+	proc->ip    = 0;
+	vmPushReturn(proc);
+	proc->fp    = lambda;
+
+	atomic_store(&proc->state, PS_RUNNABLE);
+	vmSchedule(proc);
+	return proc;
+}
+
+void
+vmWake(Process* proc) {
+	uint32_t    state   = atomic_load(&proc->state);
+	while( true ) {
+		switch( state ) {
+		case PS_WAITING:
+			if( atomic_compare_exchange_weak(&proc->state, &state, PS_RUNNABLE) ) {
+				vmSchedule(proc);
+				return;
+			}
+			break;
+		case PS_RUNNING:
+			if( atomic_compare_exchange_weak(&proc->state, &state, PS_WOKEN) ) {
+				return;
+			}
+			break;
+		default:
+			return;     // already on its way
+		}
+	}
+}
+
+void
+vmWaitAndRetry(Process* proc) {
+	VM*     vm  = proc->vm;
+	// natives invoked directly (from the repl) have nothing to rewind, the
+	// caller invokes them again
+	if( vm->funcs[proc->fp].type == FT_INTERP ) {
+		--proc->ip;
+	}
+	proc->wait.requested        = true;
+	proc->exceptFlags.indiv.yF  = true;
+}
+
+void
+vmYieldUnscheduled(Process* proc) {
+	VM*         vm      = proc->vm;
+	Scheduler*  sched   = &vm->sched;
+
+	proc->exceptFlags.indiv.yF  = false;
+	if( !proc->wait.requested ) {
+		return;
+	}
+	proc->wait.requested    = false;
+
+	// nobody parks this thread, keep the timers going until vmWake marks it
+	uint32_t    woken   = PS_WOKEN;
+	while( !atomic_compare_exchange_strong(&proc->state, &woken, PS_RUNNING) ) {
+		woken   = PS_WOKEN;
+		fireTimers(sched, vmTicks(vm));
+
+		struct timespec ts  = { .tv_sec = 0, .tv_nsec = SCHED_TICK_NS };
+		nanosleep(&ts, NULL);
+	}
+}
+
+void
+vmTimerStart(VM* vm, Timer* timer, uint32_t delay, uint32_t period, TimerCallback callback, void* data) {
+	Scheduler*  sched   = &vm->sched;
+	uint64_t    next    = 0;
+
+	pthread_mutex_lock(&sched->timerLock);
+	timer->expiry   = vmTicks(vm) + (delay ? delay : 1);
+	timer->period   = period;
+	timer->callback = callback;
+	timer->data     = data;
+	TimerWheel_insert(&sched->timers, timer);
+
+	next    = atomic_load(&sched->nextExpiry);
+	atomic_store(&sched->nextExpiry, TimerWheel_nextExpiry(&sched->timers));
+	pthread_mutex_unlock(&sched->timerLock);
+
+	// parked workers sleep until the previous expiry, one of them has to recompute
+	if( timer->expiry < next ) {
+		wakeWorker(sched);
+	}
+}
+
+void
+vmTimerCancel(VM* vm, Timer* timer) {
+	Scheduler*  sched   = &vm->sched;
+	pthread_mutex_lock(&sched->timerLock);
+	TimerWheel_cancel(&sched->timers, timer);
+	pthread_mutex_unlock(&sched->timerLock);
+}
+
+// Return: the process pid with its queues held until unpinProcess, NULL if it
+// ended or has no mailbox
+static
+Process*
+pinProcess(VM* vm, uint64_t pid) {
+	uint32_t    slot    = (uint32_t)pid;
+	if( slot >= vm->procCap ) {
+		return NULL;
+	}
+
+	// the pid is only read once the slot is open, vmReleaseProcess closes it
+	// before clearing the slot and vmSpawn opens it once the mailbox exists
+	Process*    proc    = &vm->procs[slot];
+	uint32_t    pins    = atomic_fetch_add_explicit(&proc->pins, 1, memory_order_acq_rel);
+	if( (pins & PROC_OPEN) == 0 || proc->pid != pid ) {
+		atomic_fetch_sub_explicit(&proc->pins, 1, memory_order_release);
+		return NULL;
+	}
+	return proc;
+}
+
+static
+void
+unpinProcess(Process* proc) {
+	atomic_fetch_sub_explicit(&proc->pins, 1, memory_order_release);
+}
+
+static
+bool
+postMessage(VM* vm, Process* sender, uint64_t pid, Message m) {
+	// out of memory fails the send like a full mailbox
+	Message*    msg     = (Message*)Slab_alloc(sizeof(Message));
+	if( msg == NULL ) {
+		return false;
+	}
+	*msg    = m;
+
+	Process*    proc    = pinProcess(vm, pid);
+	if( proc == NULL ) {
+		Slab_free(msg);
+		return false;
+	}
+
+	// a process runs on one worker at a time, so the owner is a single producer.
+	// The slot is pinned, neither the claim nor the ring can land on a slot
+	// vmReleaseProcess is clearing
+	uint64_t    owner   = atomic_load_explicit(&proc->link.owner, memory_order_acquire);
+	if( sender && owner == 0 ) {
+		if( atomic_compare_exchange_strong(&proc->link.owner, &owner, sender->pid + 1) ) {
+			owner   = sender->pid + 1;
+			// the receiver only pops the ring once it is published, without one
+			// the owner keeps posting to the mailbox
+			if( SpscQueue_init(&proc->link.ring, proc->mailbox.cap)->slots ) {
+				atomic_store_explicit(&proc->link.isReady, true, memory_order_release);
+				vmMemTrack(sender, MEM_QUEUES, vmLinkBytes(proc));
+			}
+		}
+	}
+
+	// the owner published the ring itself, a relaxed load is enough here
+	bool        isSent;
+	if( sender && owner == sender->pid + 1 && atomic_load_explicit(&proc->link.isReady, memory_order_relaxed) ) {
+		isSent  = SpscQueue_push(&proc->link.ring, msg);
+	} else {
+		isSent  = BoundedQueue_push(&proc->mailbox, msg);
+	}
+
+	if( isSent ) {
+		vmMemTrack(sender, MEM_MESSAGES, (int64_t)Slab_size(msg));
+		vmWake(proc);
+	} else {
+		Slab_free(msg);
+	}
+	unpinProcess(proc);
+	return isSent;
+}
+
+bool
+vmSend(VM* vm, Process* sender, uint64_t pid, void* addr, uint32_t size) {
+	return postMessage(vm, sender, pid, (Message){ .addr = addr, .size = size, .isShared = false });
+}
+
+bool
+vmSendBuffer(VM* vm, Process* sender, uint64_t pid, Buffer* buf) {
+	if( buf == NULL || !buf->isFrozen ) {
+		return false;
+	}
+
+	// a pointer per receiver, the data is never copied
+	Buffer_retain(buf);
+	if( !postMessage(vm, sender, pid, (Message){ .addr = buf, .size = buf->size, .isShared = true }) ) {
+		Buffer_release(buf);
+		return false;
+	}
+	return true;
+}
+
+bool
+vmReceive(Process* proc, Message* msg) {
+	if( proc->mailbox.elements == NULL ) {
+		return false;
+	}
+
+	// alternate so that neither the link nor the mailbox starves the other
+	Message*    m   = NULL;
+	proc->link.isFirst  = !proc->link.isFirst;
+	if( !atomic_load_explicit(&proc->link.isReady, memory_order_acquire) ) {
+		m   = BoundedQueue_pop(&proc->mailbox);
+	} else if( proc->link.isFirst ) {
+		m   = SpscQueue_pop(&proc->link.ring);
+		m   = m ? m : BoundedQueue_pop(&proc->mailbox);
+	} else {
+		m   = BoundedQueue_pop(&proc->mailbox);
+		m   = m ? m : SpscQueue_pop(&proc->link.ring);
+	}
+	if( m == NULL ) {
+		return false;
+	}
+
+	*msg    = *m;
+	vmMemTrack(proc, MEM_MESSAGES, -(int64_t)Slab_size(m));
+	Slab_free(m);
+	return true;
+}
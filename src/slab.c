@@ -0,0 +1,447 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Size classes
+////////////////////////////////////////////////////////////////////////////////
+//
+// 16 bytes steps up to 128, then 4 classes per power of 2 up to SLAB_MAX_SMALL
+// (at most 25% lost to rounding)
+//
+
+#define CLASS_COUNT     32
+#define CLASS_LARGE     CLASS_COUNT
+#define CLASS_REGION    (CLASS_COUNT + 1)
+#define SPAN_HEADER     128
+
+static const uint32_t   classSizes[CLASS_COUNT] = {
+	16,     32,     48,     64,     80,     96,     112,    128,
+	160,    192,    224,    256,    320,    384,    448,    512,
+	640,    768,    896,    1024,   1280,   1536,   1792,   2048,
+	2560,   3072,   3584,   4096,   5120,   6144,   7168,   8192
+};
+
+static inline
+uint32_t
+classOf(size_t size) {
+	if( size <= 128 ) {
+		return size == 0 ? 0 : (uint32_t)((size - 1) >> 4);
+	}
+	size_t      s       = size - 1;
+	uint32_t    msb     = 63 - (uint32_t)__builtin_clzll(s);
+	uint32_t    sub     = (uint32_t)(s >> (msb - 2)) & 3;
+	return 8 + (msb - 7) * 4 + sub;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Spans and heaps
+////////////////////////////////////////////////////////////////////////////////
+//
+// a span is a SLAB_SPAN_SIZE aligned mapping starting with its header, so the
+// span of any block is found by masking its address. Blocks are carved lazily
+// (bump) and recycled through the local free list. Only the remote list is
+// shared: other threads push on it, the owner takes it as a whole. A span is
+// never unmapped while remote frees are pending since their blocks still count
+// as used.
+//
+
+typedef struct Block    Block;
+typedef struct Span     Span;
+typedef struct Heap     Heap;
+
+struct Block {
+	Block*      next;
+};
+
+struct Span {
+	Heap*       heap;       // owner, never changes
+	Span*       prev;
+	Span*       next;
+	Block*      free;       // owner only
+	Block*      remote;     // freed by other threads
+	char*       bump;       // never handed out yet
+	char*       end;
+	size_t      mapSize;    // large objects and region chunks only
+	uint32_t    sizeClass;
+	uint32_t    used;       // blocks handed out, remote frees included until collected
+	bool        isFull;
+};
+
+_Static_assert(sizeof(Span) <= SPAN_HEADER, "span header must fit in SPAN_HEADER");
+
+typedef struct {
+	Span*       first;
+	Span*       last;
+} SpanList;
+
+struct Heap {
+	SpanList    active[CLASS_COUNT];    // spans with free blocks, the first is allocated from
+	SpanList    full[CLASS_COUNT];      // spans without free blocks, maybe with remote frees
+	Heap*       next;                   // heap list
+	atomic_bool isActive;               // owned by a live thread
+};
+
+static Heap*                heaps       = NULL;
+static pthread_once_t       globalsOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t        heapKey;
+static size_t               pageSize;
+static _Thread_local Heap*  localHeap   = NULL;
+
+static inline
+Span*
+spanOf(const void* ptr) {
+	return (Span*)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SPAN_SIZE - 1));
+}
+
+static
+void
+listRemove(SpanList* l, Span* s) {
+	if( s->prev ) { s->prev->next = s->next; } else { l->first = s->next; }
+	if( s->next ) { s->next->prev = s->prev; } else { l->last = s->prev; }
+	s->prev = s->next   = NULL;
+}
+
+static
+void
+listPushFront(SpanList* l, Span* s) {
+	s->prev = NULL;
+	s->next = l->first;
+	if( l->first ) { l->first->prev = s; } else { l->last = s; }
+	l->first    = s;
+}
+
+static
+void
+listPushBack(SpanList* l, Span* s) {
+	s->next = NULL;
+	s->prev = l->last;
+	if( l->last ) { l->last->next = s; } else { l->first = s; }
+	l->last = s;
+}
+
+// Return: a SLAB_SPAN_SIZE aligned mapping of size bytes, NULL on failure
+static
+void*
+mapAligned(size_t size) {
+	char*   raw = mmap(NULL, size + SLAB_SPAN_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if( raw == MAP_FAILED ) {
+		return NULL;
+	}
+
+	char*   aligned = (char*)(((uintptr_t)raw + SLAB_SPAN_SIZE - 1) & ~(uintptr_t)(SLAB_SPAN_SIZE - 1));
+	size_t  head    = (size_t)(aligned - raw);
+	if( head ) {
+		munmap(raw, head);
+	}
+	munmap(aligned + size, SLAB_SPAN_SIZE - head);
+	return aligned;
+}
+
+static
+void
+onThreadExit(void* arg) {
+	Heap*   heap    = arg;
+	// spans stay with the heap until it is adopted, remote frees keep piling up
+	atomic_store(&heap->isActive, false);
+}
+
+static
+void
+initGlobals() {
+	pageSize    = (size_t)sysconf(_SC_PAGESIZE);
+	pthread_key_create(&heapKey, onThreadExit);
+}
+
+static
+Heap*
+threadHeap() {
+	Heap*   heap    = localHeap;
+	if( heap ) {
+		return heap;
+	}
+
+	pthread_once(&globalsOnce, initGlobals);
+
+	for( heap = atomic_load(&heaps); heap; heap = heap->next ) {
+		bool    isActive    = false;
+		if( atomic_compare_exchange_strong(&heap->isActive, &isActive, true) ) {
+			break;
+		}
+	}
+
+	if( heap == NULL ) {
+		heap    = calloc(1, sizeof(Heap));
+		atomic_store(&heap->isActive, true);
+		Heap*   head    = atomic_load(&heaps);
+		do {
+			heap->next  = head;
+		} while( !atomic_compare_exchange_weak(&heaps, &head, heap) );
+	}
+
+	localHeap   = heap;
+	pthread_setspecific(heapKey, heap);
+	return heap;
+}
+
+static
+Span*
+newSpan(Heap* heap, uint32_t sizeClass) {
+	Span*   s   = mapAligned(SLAB_SPAN_SIZE);
+	if( s == NULL ) {
+		return NULL;
+	}
+
+	uint32_t    blockSize   = classSizes[sizeClass];
+	memset(s, 0, sizeof(Span));
+	s->heap         = heap;
+	s->sizeClass    = sizeClass;
+	s->bump         = (char*)s + SPAN_HEADER;
+	s->end          = s->bump + (SLAB_SPAN_SIZE - SPAN_HEADER) / blockSize * blockSize;
+	listPushFront(&heap->active[sizeClass], s);
+	return s;
+}
+
+// take the blocks freed by other threads
+// Return: true if any
+static
+bool
+collectRemote(Span* s) {
+	if( atomic_load_explicit(&s->remote, memory_order_relaxed) == NULL ) {
+		return false;
+	}
+
+	Block*  b   = atomic_exchange_explicit(&s->remote, NULL, memory_order_acquire);
+	while( b ) {
+		Block*  next    = b->next;
+		b->next = s->free;
+		s->free = b;
+		--s->used;
+		b   = next;
+	}
+	return true;
+}
+
+// Return: a span of the class with a free block, NULL if out of memory
+static
+Span*
+findSpan(Heap* heap, uint32_t sizeClass) {
+	SpanList*   active  = &heap->active[sizeClass];
+	SpanList*   full    = &heap->full[sizeClass];
+
+	while( active->first ) {
+		Span*   s   = active->first;
+		if( s->free || s->bump < s->end || collectRemote(s) ) {
+			return s;
+		}
+		listRemove(active, s);
+		listPushBack(full, s);
+		s->isFull   = true;
+	}
+
+	// full spans that got blocks back from other threads
+	for( Span* s = full->first; s; ) {
+		Span*   next    = s->next;
+		if( collectRemote(s) ) {
+			listRemove(full, s);
+			listPushBack(active, s);
+			s->isFull   = false;
+		}
+		s   = next;
+	}
+	if( active->first ) {
+		return active->first;
+	}
+
+	return newSpan(heap, sizeClass);
+}
+
+static
+void*
+allocLarge(size_t size) {
+	pthread_once(&globalsOnce, initGlobals);
+	size_t  mapSize = (SPAN_HEADER + size + pageSize - 1) & ~(pageSize - 1);
+	Span*   s       = mapAligned(mapSize);
+	if( s == NULL ) {
+		return NULL;
+	}
+	memset(s, 0, sizeof(Span));
+	s->sizeClass    = CLASS_LARGE;
+	s->mapSize      = mapSize;
+	return (char*)s + SPAN_HEADER;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// API
+////////////////////////////////////////////////////////////////////////////////
+
+void*
+Slab_alloc(size_t size) {
+	if( size > SLAB_MAX_SMALL ) {
+		return allocLarge(size);
+	}
+
+	Heap*       heap        = threadHeap();
+	uint32_t    sizeClass   = classOf(size);
+	Span*       s           = findSpan(heap, sizeClass);
+	if( s == NULL ) {
+		return NULL;
+	}
+
+	Block*  b   = s->free;
+	if( b ) {
+		s->free = b->next;
+	} else {
+		b       = (Block*)s->bump;
+		s->bump += classSizes[sizeClass];
+	}
+	++s->used;
+	return b;
+}
+
+void
+Slab_free(void* ptr) {
+	if( ptr == NULL ) {
+		return;
+	}
+
+	Span*   s   = spanOf(ptr);
+	if( s->sizeClass == CLASS_LARGE ) {
+		munmap(s, s->mapSize);
+		return;
+	}
+	if( s->sizeClass == CLASS_REGION ) {
+		return; // goes away with its region
+	}
+
+	Block*  b   = ptr;
+	Heap*   heap= localHeap;
+	if( s->heap != heap ) {
+		Block*  head    = atomic_load_explicit(&s->remote, memory_order_relaxed);
+		do {
+			b->next = head;
+		} while( !atomic_compare_exchange_weak_explicit(&s->remote, &head, b, memory_order_release, memory_order_relaxed) );
+		return;
+	}
+
+	b->next = s->free;
+	s->free = b;
+	--s->used;
+
+	SpanList*   active  = &heap->active[s->sizeClass];
+	if( s->isFull ) {
+		listRemove(&heap->full[s->sizeClass], s);
+		listPushBack(active, s);
+		s->isFull   = false;
+	}
+
+	// keep one span per class around so that alloc/free pairs do not map and unmap
+	if( s->used == 0 && (active->first != s || s->next != NULL) ) {
+		listRemove(active, s);
+		munmap(s, SLAB_SPAN_SIZE);
+	}
+}
+
+size_t
+Slab_size(const void* ptr) {
+	Span*   s   = spanOf(ptr);
+	switch( s->sizeClass ) {
+	case CLASS_LARGE:   return s->mapSize - SPAN_HEADER;
+	case CLASS_REGION:  return 0;
+	default:            return classSizes[s->sizeClass];
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Regions
+////////////////////////////////////////////////////////////////////////////////
+//
+// region chunks are spans too, tagged CLASS_REGION and chained through next.
+// Fresh mappings are zeroed and never reused, so blocks need no clearing. A
+// block above a quarter of a chunk gets a chunk of its own and the current
+// chunk keeps being bumped.
+//
+
+#define REGION_DEDICATED    ((SLAB_SPAN_SIZE - SPAN_HEADER) / 4)
+
+void*
+SlabRegion_alloc(SlabRegion* region, size_t size) {
+	size    = (size + 15) & ~(size_t)15;
+	if( size <= (size_t)(region->end - region->bump) ) {
+		void*   block   = region->bump;
+		region->bump    += size;
+		return block;
+	}
+
+	pthread_once(&globalsOnce, initGlobals);
+	bool    isDedicated = size > REGION_DEDICATED;
+	size_t  mapSize     = isDedicated ? (SPAN_HEADER + size + pageSize - 1) & ~(pageSize - 1) : SLAB_SPAN_SIZE;
+	Span*   c           = mapAligned(mapSize);
+	if( c == NULL ) {
+		return NULL;
+	}
+	memset(c, 0, sizeof(Span));
+	c->sizeClass    = CLASS_REGION;
+	c->mapSize      = mapSize;
+	c->next         = region->chunks;
+	region->chunks  = c;
+	region->mapped  += mapSize;
+
+	char*   block   = (char*)c + SPAN_HEADER;
+	if( !isDedicated ) {
+		region->bump    = block + size;
+		region->end     = (char*)c + mapSize;
+	}
+	return block;
+}
+
+void
+SlabRegion_release(SlabRegion* region) {
+	Span*   c   = region->chunks;
+	while( c ) {
+		Span*   next    = c->next;
+		munmap(c, c->mapSize);
+		c   = next;
+	}
+	memset(region, 0, sizeof(SlabRegion));
+}
+
+bool
+Slab_isRegion(const void* ptr) {
+	return ptr && spanOf(ptr)->sizeClass == CLASS_REGION;
+}
+
+void*
+Slab_promote(void* ptr, size_t size) {
+	if( !Slab_isRegion(ptr) ) {
+		return ptr;
+	}
+
+	void*   copy    = Slab_alloc(size);
+	if( copy ) {
+		memcpy(copy, ptr, size);
+	}
+	return copy;
+}
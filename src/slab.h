@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Slab Allocator
+////////////////////////////////////////////////////////////////////////////////
+//
+// every thread allocates from its own heap without locking. A heap owns spans
+// of SLAB_SPAN_SIZE bytes (aligned on their size), each span is cut in blocks
+// of a single size class. Blocks freed by the owner go back to the span free
+// list, blocks freed by another thread are pushed on the span remote free list
+// (lock-free) and collected by the owner when it runs out of blocks. Requests
+// above SLAB_MAX_SMALL get their own mapping.
+//
+// Heaps of exited threads are adopted by the next new thread, their blocks
+// stay valid.
+//
+
+#define SLAB_SPAN_SIZE      (64 * 1024)
+#define SLAB_MAX_SMALL      8192
+
+/// Return: a 16 bytes aligned block of at least size bytes (not cleared), NULL if out of memory
+void*       Slab_alloc(size_t size);
+
+/// free a block from any thread, NULL is ignored
+void        Slab_free(void* ptr);
+
+/// Return: usable size of the block, 0 for region blocks
+size_t      Slab_size(const void* ptr);
+
+////////////////////////////////////////////////////////////////////////////////
+// Regions
+////////////////////////////////////////////////////////////////////////////////
+//
+// bump-pointer allocation from chunks owned by a single thread at a time,
+// blocks are never freed one by one (Slab_free ignores them) but all at once
+// with the region. A block meant to outlive its region has to be promoted to
+// the slab heap first.
+//
+
+typedef struct {
+	void*       chunks;     // mapped chunks, most recent first
+	char*       bump;       // free part of the most recent chunk
+	char*       end;
+	size_t      mapped;     // bytes mapped by the region
+} SlabRegion;
+
+/// Return: a 16 bytes aligned, zeroed block of at least size bytes, NULL if out of memory
+void*       SlabRegion_alloc(SlabRegion* region, size_t size);
+
+/// unmap every chunk of the region, its blocks become invalid
+void        SlabRegion_release(SlabRegion* region);
+
+/// Return: true if ptr was allocated from a region
+bool        Slab_isRegion(const void* ptr);
+
+/// Return: ptr if it is a slab block, a slab copy of its first size bytes if it belongs to a region
+void*       Slab_promote(void* ptr, size_t size);
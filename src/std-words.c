@@ -81,12 +81,13 @@ isInCompileMode(Process* proc) {
 static
 void
 decompileOpcode(VM* vm, uint32_t opcode) {
+	char    nameBuf[VM_NAME_SIZE];
 	switch(opcode & OP_CALL) {
 	case OP_VALUE:
 		fprintf(stdout, "\t%u\n", opcode);
 		break;
 	case OP_CALL:
-		fprintf(stdout, "\t%s\n", &vm->chars[vm->funcs[opcode & 0x7FFFFFFF].nameOffset]);
+		fprintf(stdout, "\t%s\n", vmFunctionName(vm, opcode & 0x7FFFFFFF, nameBuf));
 		break;
 	}
 }
@@ -101,7 +102,9 @@ startFuncCompilation(Process* proc) {
 	char    token[MAX_TOKEN_SIZE + 1] = { 0 };
 	readToken(vm, MAX_TOKEN_SIZE, token);
 
-	vm->compilerState.cfs[vm->compilerState.cfsCount].funcId    = vmAllocateInterpFunction(vm, token);
+	// a function that could not be allocated still compiles its body, it is
+	// dropped by finishFuncCompilation
+	vm->compilerState.cfs[vm->compilerState.cfsCount].funcId    = vmAllocateInterpFunction(proc, token);
 	vm->compilerState.cfs[vm->compilerState.cfsCount].ciStart   = vm->compilerState.cisCount;
 
 	++vm->compilerState.cfsCount;
@@ -116,8 +119,10 @@ startMacroCompilation(Process* proc) {
 	char    token[MAX_TOKEN_SIZE + 1] = { 0 };
 	readToken(vm, MAX_TOKEN_SIZE, token);
 
-	uint32_t    funcId  = vmAllocateInterpFunction(vm, token);
-	vm->funcs[funcId].isImmediate    = true;
+	uint32_t    funcId  = vmAllocateInterpFunction(proc, token);
+	if( funcId != VM_NO_FUNCTION ) {
+		vm->funcs[funcId].isImmediate    = true;
+	}
 
 	vm->compilerState.cfs[vm->compilerState.cfsCount].funcId    = funcId;
 	vm->compilerState.cfs[vm->compilerState.cfsCount].ciStart   = vm->compilerState.cisCount;
@@ -133,22 +138,50 @@ finishFuncCompilation(Process* proc) {
 	assert(vm->compilerState.cfsCount > 0);
 
 	uint32_t    funcId      = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].funcId;
+	uint32_t    ciStart     = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].ciStart;
+	uint32_t    ciEnd       = vm->compilerState.cisCount;
+
+	// the function literals of the body are the last refs
+	uint32_t    refEnd      = vm->compilerState.refCount;
+	uint32_t    refStart    = refEnd;
+	while( refStart > 0 && vm->compilerState.refs[refStart - 1] >= ciStart ) {
+		--refStart;
+	}
+
+	vm->compilerState.cisCount    = ciStart;
+	vm->compilerState.refCount    = refStart;
+	--vm->compilerState.cfsCount;
+	if( funcId == VM_NO_FUNCTION ) {
+		return;
+	}
 
-	log("finish %s (%d):\n", &vm->chars[vm->funcs[funcId].nameOffset], funcId);
+#ifndef NDEBUG
+	char    nameBuf[VM_NAME_SIZE];
+	log("finish %s (%d):\n", vmFunctionName(vm, funcId, nameBuf), funcId);
+#endif
 
-	uint32_t    insCount    = 0;
+	// workers materializing module functions append to the code segment too
+	pthread_mutex_lock(&vm->codeLock);
 	uint32_t    insOffset   = vm->insCount;
-
-	for( uint32_t ci = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].ciStart; ci < vm->compilerState.cisCount; ++ci) {
-		++insCount;
-		vmPushInstruction(vm, vm->compilerState.cis[ci]);
+	for( uint32_t ci = ciStart; ci < ciEnd; ++ci) {
+		if( !vmPushInstruction(proc, vm->compilerState.cis[ci]) ) {
+			// the code segment is full, the function keeps an empty body
+			vm->insCount    = insOffset;
+			pthread_mutex_unlock(&vm->codeLock);
+			return;
+		}
 		decompileOpcode(vm, vm->compilerState.cis[ci]);
 	}
 
-	vm->compilerState.cisCount    = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].ciStart;
+	// the entries past refCount are still there, nothing was compiled meanwhile.
+	// They fit, there are no more relocations than instructions
+	for( uint32_t r = refStart; r < refEnd; ++r ) {
+		vmPushRelocation(vm, insOffset + vm->compilerState.refs[r] - ciStart);
+	}
+	pthread_mutex_unlock(&vm->codeLock);
+
 	vm->funcs[funcId].u.interp.insOffset  = insOffset;
-	vm->funcs[funcId].u.interp.insCount   = insCount;
-	--vm->compilerState.cfsCount;
+	vm->funcs[funcId].u.interp.insCount   = ciEnd - ciStart;
 }
 
 static
@@ -161,6 +194,8 @@ readString(Process* proc) {
 		proc->ss.chars[proc->ss.charCount]    = (char)ch;
 		++proc->ss.charCount;
 	}
+	proc->ss.chars[proc->ss.charCount]    = '\0';
+	++proc->ss.charCount;
 
 	assert(proc->ss.stringCount < proc->ss.stringCap);
 	proc->ss.strings[proc->ss.stringCount]  = strStartIdx;
@@ -188,9 +223,9 @@ wordAddress(Process* proc) {
 	uint32_t funcId = vmFindFunction(vm, token);
 	assert(funcId != 0);
 	if( isInCompileMode(proc) ) {
-		vmPushCompilerInstruction(vm, funcId - 1);
+		vmPushCompilerReference(vm, funcId - 1);
 	} else {
-		vmPushValue(proc, (Value) { .u32 = funcId - 1 });
+		vmPushValue(proc, (Value) { .u64 = funcId - 1 });
 	}
 }
 
@@ -198,9 +233,10 @@ wordAddress(Process* proc) {
 static
 void
 listWords(Process* proc) {
-	VM* vm  = proc->vm;
+	VM*     vm  = proc->vm;
+	char    nameBuf[VM_NAME_SIZE];
 	for( uint32_t f = 0; f < vm->funcCount; ++f ) {
-		fprintf(stdout, "%d - %s : %d : %d\n", f, &vm->chars[vm->funcs[f].nameOffset], vm->funcs[f].inVS, vm->funcs[f].outVS);
+		fprintf(stdout, "%d - %s : %d : %d\n", f, vmFunctionName(vm, f, nameBuf), vm->funcs[f].inVS, vm->funcs[f].outVS);
 	}
 }
 
@@ -219,14 +255,23 @@ see(Process* proc) {
 	char    token[MAX_TOKEN_SIZE + 1] = { 0 };
 	readToken(vm, MAX_TOKEN_SIZE, token);
 
+	// lambdas are not in the dictionary, they are seen by their synthesized name
 	uint32_t    funcId  = vmFindFunction(vm, token);
+	uint32_t    lambda;
+	char        nameBuf[VM_NAME_SIZE];
+	if( funcId == 0 && sscanf(token, "lambda#%u", &lambda) == 1 && lambda < vm->funcCount && vm->funcs[lambda].nameOffset == VM_NO_NAME ) {
+		funcId  = lambda + 1;
+	}
 
 	switch(funcId) {
 	case 0:
 		fprintf(stdout, "word %s doesn't exist\n", token);
 		break;
 	default:
-		fprintf(stdout, "%d - %s:\n", funcId - 1, &vm->chars[vm->funcs[funcId - 1].nameOffset]);
+		fprintf(stdout, "%d - %s:\n", funcId - 1, vmFunctionName(vm, funcId - 1, nameBuf));
+		if( vm->funcs[funcId - 1].type == FT_LAZY ) {
+			vmModuleMaterialize(vm, funcId - 1, &proc->exceptFlags);
+		}
 		switch(vm->funcs[funcId - 1].type) {
 		case FT_NATIVE:
 			fprintf(stderr, "\t<native>\n");
@@ -238,6 +283,9 @@ see(Process* proc) {
 				decompileOpcode(vm, opcode);
 			}
 			break;
+		case FT_LAZY:
+			fprintf(stderr, "\t<not materialized>\n");
+			break;
 		}
 	}
 }
@@ -248,6 +296,268 @@ quit(Process* proc) {
 	proc->vm->quit    = true;
 }
 
+static
+void
+setReductionBudget(Process* proc) {
+	Value   v   = vmPopValue(proc);
+	vmSetReductionBudget(proc, v.u32);
+}
+
+static
+void
+useRegion(Process* proc) {
+	Value   v   = vmPopValue(proc);
+	proc->useRegion = v.b;
+}
+
+// copy a region buffer out before handing it to a process that may outlive ours
+static
+void
+promoteBuffer(Process* proc) {
+	Value   size    = vmPopValue(proc);
+	Value   addr    = vmPopValue(proc);
+	void*   buff    = Slab_promote(addr.ref, size.u32);
+	if( buff && buff != addr.ref ) {
+		vmMemTrack(proc, MEM_MAP, (int64_t)Slab_size(buff));
+	}
+	vmPushValue(proc, (Value){ .ref = buff });
+}
+
+static
+void
+newBuffer(Process* proc) {
+	Value   size    = vmPopValue(proc);
+	vmPushValue(proc, (Value){ .ref = Buffer_new(size.u32) });
+}
+
+static
+void
+freezeBuffer(Process* proc) {
+	Value   buf     = vmPopValue(proc);
+	vmPushValue(proc, (Value){ .ref = Buffer_freeze(buf.ref) });
+}
+
+static
+void
+retainBuffer(Process* proc) {
+	Value   buf     = vmPopValue(proc);
+	vmPushValue(proc, (Value){ .ref = Buffer_retain(buf.ref) });
+}
+
+static
+void
+releaseBuffer(Process* proc) {
+	Value   buf     = vmPopValue(proc);
+	Buffer_release(buf.ref);
+}
+
+static
+void
+sliceBuffer(Process* proc) {
+	Value   size    = vmPopValue(proc);
+	Value   offset  = vmPopValue(proc);
+	Value   buf     = vmPopValue(proc);
+	vmPushValue(proc, (Value){ .ref = Buffer_slice(buf.ref, offset.u32, size.u32) });
+}
+
+static
+void
+bufferSize(Process* proc) {
+	Buffer* buf     = vmPopValue(proc).ref;
+	vmPushValue(proc, (Value){ .u32 = buf ? buf->size : 0 });
+}
+
+static
+void
+bufferData(Process* proc) {
+	Buffer* buf     = vmPopValue(proc).ref;
+	vmPushValue(proc, (Value){ .ref = buf ? buf->data : NULL });
+}
+
+// a NULL buffer (buf.new out of memory, a refused buf.slice) is empty: out of
+// bounds reads give 0, writes to frozen buffers or out of bounds are dropped
+static
+void
+readBufferU32(Process* proc) {
+	Value   idx     = vmPopValue(proc);
+	Buffer* buf     = vmPopValue(proc).ref;
+	Value   v       = { .u64 = 0 };
+	if( buf && idx.u32 < buf->size / sizeof(uint32_t) ) {
+		memcpy(&v.u32, buf->data + idx.u32 * sizeof(uint32_t), sizeof(uint32_t));
+	}
+	vmPushValue(proc, v);
+}
+
+static
+void
+writeBufferU32(Process* proc) {
+	Value   idx     = vmPopValue(proc);
+	Buffer* buf     = vmPopValue(proc).ref;
+	Value   v       = vmPopValue(proc);
+	if( buf && !buf->isFrozen && idx.u32 < buf->size / sizeof(uint32_t) ) {
+		memcpy(buf->data + idx.u32 * sizeof(uint32_t), &v.u32, sizeof(uint32_t));
+	}
+}
+
+static
+void
+sendBuffer(Process* proc) {
+	Value   pid     = vmPopValue(proc);
+	Value   buf     = vmPopValue(proc);
+	vmPushValue(proc, (Value){ .u32 = vmSendBuffer(proc->vm, proc, pid.u64, buf.ref) });
+}
+
+static
+void
+spawnWithPriority(Process* proc) {
+	Value       prio    = vmPopValue(proc);
+	Value       lambda  = vmPopValue(proc);
+	Value       qsize   = vmPopValue(proc);
+	Process*    child   = vmIsClosure(lambda) ? NULL
+	                    : vmSpawn(proc->vm, (ProcPtr){ .ptr = (uint32_t)proc->pid }, lambda.u32, qsize.u32, prio.u32 < PP_COUNT ? (ProcPriority)prio.u32 : PP_LOW);
+	vmPushValue(proc, (Value){ .u64 = child ? child->pid : 0 });
+}
+
+static
+void
+waitExpired(Timer* timer) {
+	Process*    proc    = (Process*)timer->data;
+	atomic_store(&proc->wait.expired, true);
+	vmWake(proc);
+}
+
+static
+void
+armWait(Process* proc, uint32_t ms) {
+	if( !proc->wait.isArmed ) {
+		atomic_store(&proc->wait.expired, false);
+		proc->wait.isArmed  = true;
+		vmTimerStart(proc->vm, &proc->wait.timer, ms, 0, waitExpired, proc);
+	}
+}
+
+static
+void
+sleepMs(Process* proc) {
+	Value   ms  = vmPopValue(proc);
+	armWait(proc, ms.u32);
+	if( atomic_load(&proc->wait.expired) ) {
+		proc->wait.isArmed  = false;
+	} else {
+		vmPushValue(proc, ms);
+		vmWaitAndRetry(proc);
+	}
+}
+
+static
+void
+receiveWithTimeout(Process* proc) {
+	Value   ms      = vmPopValue(proc);
+	Message msg     = { .addr = NULL, .size = 0 };
+	bool    isRecv  = vmReceive(proc, &msg);
+
+	if( isRecv || (proc->wait.isArmed && atomic_load(&proc->wait.expired)) ) {
+		if( proc->wait.isArmed ) {
+			vmTimerCancel(proc->vm, &proc->wait.timer);
+			proc->wait.isArmed  = false;
+		}
+		vmPushValue(proc, (Value){ .ref = msg.addr });
+		vmPushValue(proc, (Value){ .u32 = msg.size });
+		vmPushValue(proc, (Value){ .u32 = isRecv });
+	} else {
+		armWait(proc, ms.u32);
+		vmPushValue(proc, ms);
+		vmWaitAndRetry(proc);
+	}
+}
+
+static
+void
+tickExpired(Timer* timer) {
+	Process*    proc    = (Process*)timer->data;
+	vmSend(proc->vm, NULL, proc->pid, NULL, 0);
+}
+
+static
+void
+tickEvery(Process* proc) {
+	Value   ms  = vmPopValue(proc);
+	if( ms.u32 ) {
+		vmTimerStart(proc->vm, &proc->ticker, ms.u32, ms.u32, tickExpired, proc);
+	} else {
+		vmTimerCancel(proc->vm, &proc->ticker);
+	}
+}
+
+static
+void
+printLockFreeStats(Process* proc) {
+	(void)proc;
+	LfStats stats;
+	if( !LfStats_collect(&stats) ) {
+		fprintf(stdout, "lock-free stats are disabled (build with LF_STATS)\n");
+		return;
+	}
+	for( uint32_t s = 0; s < LF_STAT_COUNT; ++s ) {
+		fprintf(stdout, "%-16s %lu\n", LfStat_names[s], (unsigned long)stats.counts[s]);
+	}
+}
+
+static
+void
+resetLockFreeStats(Process* proc) {
+	(void)proc;
+	LfStats_reset();
+}
+
+static
+void
+printMemStats(Process* proc) {
+	(void)proc;
+	MemStats    stats;
+	if( !MemStats_collect(&stats) ) {
+		fprintf(stdout, "memory stats are disabled (build with MEM_STATS)\n");
+		return;
+	}
+	fprintf(stdout, "%-10s %12s %12s %10s %10s\n", "category", "bytes", "peak", "allocs", "frees");
+	for( uint32_t c = 0; c < MEM_CATEGORY_COUNT; ++c ) {
+		fprintf(stdout, "%-10s %12ld %12ld %10lu %10lu\n", MemCategory_names[c], (long)stats.current[c], (long)stats.peak[c],
+		        (unsigned long)stats.allocs[c], (unsigned long)stats.frees[c]);
+	}
+	fprintf(stdout, "%-10s %12ld %12ld\n", "total", (long)stats.total, (long)stats.totalPeak);
+}
+
+// functions loaded from modules and how many of them were called
+static
+void
+printModuleStats(Process* proc) {
+	VM* vm  = proc->vm;
+	fprintf(stdout, "modules: %u functions: %u materialized: %u\n", vm->modules.count, vm->modules.lazyCount,
+	        atomic_load_explicit(&vm->modules.materialized, memory_order_relaxed));
+}
+
+// live processes with what they hold, the counters of running ones are a snapshot
+static
+void
+printProcessMemStats(Process* proc) {
+	MemStats    stats;
+	if( !MemStats_collect(&stats) ) {
+		fprintf(stdout, "memory stats are disabled (build with MEM_STATS)\n");
+		return;
+	}
+	VM* vm  = proc->vm;
+	fprintf(stdout, "%-20s %12s %12s\n", "pid", "bytes", "peak");
+	uint32_t    slotTop = atomic_load(&vm->sched.slotTop);
+	for( uint32_t p = 0; p < slotTop; ++p ) {
+		Process*    other   = &vm->procs[p];
+		if( other->vm ) {
+			fprintf(stdout, "%-20lu %12ld %12ld\n", (unsigned long)other->pid,
+			        (long)atomic_load_explicit(&other->mem.used, memory_order_relaxed),
+			        (long)atomic_load_explicit(&other->mem.peak, memory_order_relaxed));
+		}
+	}
+}
+
 static
 void
 printInt(Process* proc) {
@@ -256,6 +566,33 @@ printInt(Process* proc) {
 }
 
 
+static void startLambda(Process* proc);
+static void endLambda(Process* proc);
+
+//
+// a file can only be cached as a module if loading it did nothing but define
+// words, the module would not replay anything else
+// Return: true if running func while loading keeps the file cacheable
+//
+static
+bool
+isDefinitional(Process* proc, const Function* func) {
+	NativeFunction  native  = func->type == FT_NATIVE ? func->u.native : NULL;
+	if( native == startFuncCompilation || native == startMacroCompilation || native == readCommentLine ) {
+		return true;
+	}
+	return isInCompileMode(proc)
+	    && (native == finishFuncCompilation || native == startLambda || native == endLambda || native == wordAddress);
+}
+
+static inline
+void
+markNotCacheable(VM* vm) {
+	if( vm->compilerState.recorder ) {
+		vm->compilerState.recorder->isCacheable = false;
+	}
+}
+
 void
 vmReadEvalPrintLoop(Process* proc) {
 	VM*     vm              = proc->vm;
@@ -284,17 +621,23 @@ vmReadEvalPrintLoop(Process* proc) {
 			if( isInt(token) ) { // push the value
 				Value    value = tokToInt(token);
 				if( isInCompileMode(proc) ) {
-					vmPushCompilerInstruction(vm, OP_CALL_MASK & value.u32);
+					vmPushCompilerLiteral(vm, value.u32);
 				} else {
+					markNotCacheable(vm);
 					vmPushValue(proc, value);
 				}
 			} else {
+				markNotCacheable(vm);
 				fprintf(stderr, "Error: word %s not found in dictionnary\n", token);
 			}
 		} else {
 			if( isInCompileMode(proc) && !vm->funcs[wordId - 1].isImmediate ) {
 				vmPushCompilerInstruction(vm, OP_CALL | (wordId - 1));
 			} else {
+				if( !isDefinitional(proc, &vm->funcs[wordId - 1]) ) {
+					markNotCacheable(vm);
+				}
+
 				uint32_t    origRetCount    = proc->rsCount;
 				proc->fp  = 0;
 				proc->ip  = 0;
@@ -302,8 +645,30 @@ vmReadEvalPrintLoop(Process* proc) {
 
 				vmSetTailCall(proc, wordId - 1);
 				vmExecute(proc);
-				while(!vm->quit && proc->rsCount > origRetCount) {
-					vmNext(proc);
+				// the repl process is not scheduled, a yield resumes it right away and a
+				// wait blocks until it is woken up. Natives invoked from here cannot be
+				// rewound, they are invoked again
+				while( vm->funcs[wordId - 1].type == FT_NATIVE && proc->wait.requested ) {
+					vmYieldUnscheduled(proc);
+					vmSetTailCall(proc, wordId - 1);
+					vmExecute(proc);
+				}
+				while( !vmRunSlice(proc, origRetCount) && proc->exceptFlags.indiv.yF ) {
+					vmYieldUnscheduled(proc);
+				}
+				if( proc->exceptFlags.all ) {
+					// the repl survives its own overflows, unwind the word and clear the values
+					fprintf(stderr, "Error: %s aborted (flags: 0x%08X)\n", token, proc->exceptFlags.all);
+					markNotCacheable(vm);
+					vmGeneratorUnwind(proc);
+					Return  r   = proc->rs[origRetCount];
+					proc->rsCount   = origRetCount;
+					proc->fp        = r.fp;
+					proc->ip        = r.ip;
+					proc->lp        = r.lp;
+					proc->closure   = r.closure;
+					proc->vsCount   = 0;
+					proc->exceptFlags.all   = 0;
 				}
 			}
 		}
@@ -316,6 +681,11 @@ vmReadEvalPrintLoop(Process* proc) {
 
 #define ALL 0xFFFFFFFF  /* mostly used for immediates/macros    */
 
+//
+// load a source file, or the module cached next to it (the file name with a
+// trailing 'c') if it was built from the same source. A file that only defines
+// words is cached once loaded
+//
 static
 void
 load(Process* proc) {
@@ -323,12 +693,90 @@ load(Process* proc) {
 	Value       strIdx  = vmPopValue(proc);
 	uint32_t    strStart= proc->ss.strings[strIdx.u32];
 	const char* fName   = &proc->ss.chars[strStart];
-	Stream*     strm    = vmStreamOpenFile(vm, fName, SM_RO);
 
+	char        cacheName[MAX_TOKEN_SIZE + 2];
+	uint64_t    hash    = 0;
+	bool        canCache= vmModuleHash(fName, &hash) && snprintf(cacheName, sizeof(cacheName), "%sc", fName) < (int)sizeof(cacheName);
+	if( canCache && vmModuleLoad(proc, cacheName, hash) ) {
+		vmPopString(proc);
+		return;
+	}
+
+	ModuleRecorder  rec     = {
+		.funcStart      = vm->funcCount,
+		.insStart       = vm->insCount,
+		.isCacheable    = canCache && vm->compilerState.cfsCount == 0,
+	};
+	ModuleRecorder* outer   = vm->compilerState.recorder;
+	vm->compilerState.recorder  = &rec;
+
+	Stream*     strm    = vmStreamOpenFile(vm, fName, SM_RO);
 	vmStreamPush(vm, strm);
 	vmPushValue(proc, (Value){ .u32 = 0 });
 	vmReadEvalPrintLoop(proc);
 	vmStreamPop(vm);
+
+	vm->compilerState.recorder  = outer;
+	if( rec.isCacheable && vm->compilerState.cfsCount == 0 ) {
+		vmModuleSave(vm, &rec, cacheName, fName, hash);
+	}
+	vmPopString(proc);
+}
+
+static
+void
+saveImage(Process* proc) {
+	Value       strIdx  = vmPopValue(proc);
+	vmImageSave(proc->vm, &proc->ss.chars[proc->ss.strings[strIdx.u32]], false);
+	vmPopString(proc);
+}
+
+static
+void
+packImage(Process* proc) {
+	Value       strIdx  = vmPopValue(proc);
+	vmImageSave(proc->vm, &proc->ss.chars[proc->ss.strings[strIdx.u32]], true);
+	vmPopString(proc);
+}
+
+//
+// save a compact image of the words reachable from the roots, a string of
+// space separated word names
+//
+static
+void
+shakeImage(Process* proc) {
+	VM*         vm      = proc->vm;
+	Value       rootsIdx= vmPopValue(proc);
+	Value       strIdx  = vmPopValue(proc);
+	char*       names   = &proc->ss.chars[proc->ss.strings[rootsIdx.u32]];
+	uint32_t*   roots   = malloc((strlen(names) / 2 + 1) * sizeof(uint32_t));
+	uint32_t    count   = 0;
+	bool        isOk    = roots != NULL;
+
+	char*       save    = NULL;
+	for( char* name = strtok_r(names, " \t\n", &save); isOk && name; name = strtok_r(NULL, " \t\n", &save) ) {
+		uint32_t    fidx    = vmFindFunction(vm, name);
+		if( fidx == 0 ) {
+			fprintf(stderr, "Error: image root %s not found\n", name);
+			isOk    = false;
+		}
+		roots[count++]  = fidx - 1;
+	}
+
+	if( isOk ) {
+		vmImageShake(vm, &proc->ss.chars[proc->ss.strings[strIdx.u32]], roots, count, true);
+	}
+	free(roots);
+	vmPopString(proc);
+	vmPopString(proc);
+}
+
+static
+void
+loadImage(Process* proc) {
+	Value       strIdx  = vmPopValue(proc);
+	vmImageLoad(proc->vm, &proc->ss.chars[proc->ss.strings[strIdx.u32]]);
 	vmPopString(proc);
 }
 
@@ -344,10 +792,8 @@ startLambda(Process* proc) {
 	VM*     vm  = proc->vm;
 	assert(vm->compilerState.cfsCount < vm->compilerState.cfsCap);
 
-	char    token[MAX_TOKEN_SIZE + 1] = { 0 };
-	sprintf(token, "lambda#%d", vm->insCount);
-
-	vm->compilerState.cfs[vm->compilerState.cfsCount].funcId    = vmAllocateInterpFunction(vm, token);
+	// anonymous, the dictionary only holds named words
+	vm->compilerState.cfs[vm->compilerState.cfsCount].funcId    = vmAllocateInterpFunction(proc, NULL);
 	vm->compilerState.cfs[vm->compilerState.cfsCount].ciStart   = vm->compilerState.cisCount;
 
 	++vm->compilerState.cfsCount;
@@ -359,11 +805,13 @@ endLambda(Process* proc) {
 	VM*     vm  = proc->vm;
 	assert(vm->compilerState.cfsCount > 0);
 
-	Value       funcId      = (Value) { .u32 = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].funcId };
+	Value       funcId      = (Value) { .u64 = vm->compilerState.cfs[vm->compilerState.cfsCount - 1].funcId };
 
 	finishFuncCompilation(proc);
-	if( isInCompileMode(proc) ) {
-		vmPushCompilerInstruction(vm, funcId.u32);
+	if( funcId.u32 == VM_NO_FUNCTION ) {
+		return;     // already reported by startLambda
+	} else if( isInCompileMode(proc) ) {
+		vmPushCompilerReference(vm, funcId.u32);
 	} else {
 		vmPushValue(proc, funcId);
 	}
@@ -388,6 +836,35 @@ const NativeFunctionEntry entries[]  = {
 	{ "see",        false,  see,                        1,      0   },
 
 	{ "load",       false,  load,                       1,      0   },
+	{ "image.save", false,  saveImage,                  1,      0   },  // name -- (functions, code and chars)
+	{ "image.pack", false,  packImage,                  1,      0   },  // name -- (same, compact code)
+	{ "image.load", false,  loadImage,                  1,      0   },  // name -- (replaces the dictionary)
+	{ "image.shake",false,  shakeImage,                 2,      0   },  // name roots -- (reachable words only, compact)
+	{ "module.stats",false, printModuleStats,           0,      0   },  // -- (prints the module functions materialized)
+
+	{ "proc.budget",false,  setReductionBudget,         1,      0   },
+	{ "proc.region",false,  useRegion,                  1,      0   },  // flag -- (map from a region freed on exit)
+	{ "map.promote",false,  promoteBuffer,              2,      1   },  // mem-addr mem-size -- mem-addr
+	{ "buf.new",    false,  newBuffer,                  1,      1   },  // size -- buf (zeroed, mutable)
+	{ "buf.freeze", false,  freezeBuffer,               1,      1   },  // buf -- buf
+	{ "buf.retain", false,  retainBuffer,               1,      1   },  // buf -- buf
+	{ "buf.release",false,  releaseBuffer,              1,      0   },  // buf --
+	{ "buf.slice",  false,  sliceBuffer,                3,      1   },  // buf offset size -- buf (0 if not frozen or out of bounds)
+	{ "buf.size",   false,  bufferSize,                 1,      1   },  // buf -- size
+	{ "buf.data",   false,  bufferData,                 1,      1   },  // buf -- mem-addr
+	{ "buf.u32@",   false,  readBufferU32,              2,      1   },  // buf idx -- value
+	{ "buf.u32!",   false,  writeBufferU32,             3,      0   },  // value buf idx --
+	{ "buf.send",   false,  sendBuffer,                 2,      1   },  // buf pid -- ok (frozen only, by reference)
+	{ "spawn.prio", false,  spawnWithPriority,          3,      1   },  // queue-size lambda prio -- pid
+	{ "sleep",      false,  sleepMs,                    1,      0   },  // ms --
+	{ "recv.timeout",false, receiveWithTimeout,         1,      3   },  // ms -- mem-addr mem-size ok
+	{ "tick.every", false,  tickEvery,                  1,      0   },  // ms -- (0 stops the ticks)
+
+	{ "lf.stats",   false,  printLockFreeStats,         0,      0   },  // -- (prints the queue contention counters)
+	{ "lf.stats.reset",false,resetLockFreeStats,        0,      0   },  // --
+
+	{ "mem.stats",  false,  printMemStats,              0,      0   },  // -- (prints the bytes held per category)
+	{ "mem.procs",  false,  printProcessMemStats,       0,      0   },  // -- (prints the bytes held per live process)
 
 	{ "quit",       false,  quit,                       0,      0   },
 };
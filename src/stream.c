@@ -26,6 +26,7 @@ vmStreamOpenFile(VM* vm, const char* name, STREAM_MODE mode) {
 	FILE*   f   = fopen(name, m);
 	if(f) {
 		Stream* strm    = (Stream*)calloc(1, sizeof(Stream));
+		vmMemTrack(NULL, MEM_STREAMS, (int64_t)sizeof(Stream));
 		atomic_store(&strm->refCount,   0);
 		strm->mode      = mode;
 		strm->file      = f;
@@ -40,6 +41,7 @@ vmStreamFromFile(VM* vm, FILE* f, STREAM_MODE mode) {
 	//ABORT_ON_EXCEPTIONS_V(NULL)
 	if(f) {
 		Stream* strm    = (Stream*)calloc(1, sizeof(Stream));
+		vmMemTrack(NULL, MEM_STREAMS, (int64_t)sizeof(Stream));
 		atomic_store(&strm->refCount,   0);
 		strm->mode      = mode;
 		strm->file      = f;
@@ -55,6 +57,7 @@ vmStreamFromMemory(VM* vm, const char* str, uint32_t size) {
 	FILE*   f   = tmpfile();
 	if(f) {
 		Stream* strm    = (Stream*)calloc(1, sizeof(Stream));
+		vmMemTrack(NULL, MEM_STREAMS, (int64_t)sizeof(Stream));
 		atomic_store(&strm->refCount,   0);
 		fwrite(str, 1, size, f);
 		rewind(f);
@@ -81,7 +84,11 @@ vmStreamPop(VM* vm) {
 	if( strm->refCount != 0 ) {
 		atomic_fetch_sub(&strm->refCount, 1);
 		if( strm->refCount == 0 ) {
-			fclose(strm->file);
+			// the standard files belong to the program, keep them for what follows vmRelease
+			if( strm->file != stdin && strm->file != stdout && strm->file != stderr ) {
+				fclose(strm->file);
+			}
+			vmMemTrack(NULL, MEM_STREAMS, -(int64_t)sizeof(Stream));
 			free(strm);
 		}
 	}
@@ -0,0 +1,223 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "timer-wheel.h"
+
+static inline
+uint32_t
+levelShift(uint32_t level) {
+	return level * TIMER_WHEEL_BITS;
+}
+
+static inline
+Timer*
+bucketHead(TimerWheel* tw, uint32_t bucket) {
+	return &tw->slots[bucket / TIMER_WHEEL_SLOTS][bucket % TIMER_WHEEL_SLOTS];
+}
+
+static inline
+void
+listInit(Timer* head) {
+	head->next  = head;
+	head->prev  = head;
+}
+
+static inline
+void
+listUnlink(Timer* t) {
+	t->prev->next   = t->next;
+	t->next->prev   = t->prev;
+	t->next = t->prev = NULL;
+}
+
+static inline
+void
+listMove(Timer* dst, Timer* src) {
+	if( src->next == src ) {
+		listInit(dst);
+	} else {
+		dst->next           = src->next;
+		dst->prev           = src->prev;
+		dst->next->prev     = dst;
+		dst->prev->next     = dst;
+		listInit(src);
+	}
+}
+
+//
+// place the timer relative to tw->now, a timer due at tw->now goes into the
+// current level 0 slot (only happens while cascading, right before it is fired)
+//
+static
+void
+linkTimer(TimerWheel* tw, Timer* t) {
+	uint64_t    expiry  = t->expiry;
+	uint64_t    delta   = expiry - tw->now;
+	uint32_t    level   = 0;
+
+	if( delta >= TIMER_WHEEL_SPAN ) {
+		// too far away: park it at the top level, it will be cascaded back up
+		delta   = TIMER_WHEEL_SPAN - 1;
+		expiry  = tw->now + delta;
+	}
+
+	while( level + 1 < TIMER_WHEEL_LEVELS && delta >= (1ull << levelShift(level + 1)) ) {
+		++level;
+	}
+
+	uint32_t    slot    = (uint32_t)(expiry >> levelShift(level)) & TIMER_WHEEL_MASK;
+	Timer*      head    = &tw->slots[level][slot];
+
+	t->bucket       = level * TIMER_WHEEL_SLOTS + slot;
+	t->next         = head->next;
+	t->prev         = head;
+	head->next->prev= t;
+	head->next      = t;
+	tw->occupied[level] |= 1ull << slot;
+}
+
+static
+void
+cascade(TimerWheel* tw, uint32_t level, uint32_t slot) {
+	Timer   pending;
+	listMove(&pending, &tw->slots[level][slot]);
+	tw->occupied[level] &= ~(1ull << slot);
+
+	while( pending.next != &pending ) {
+		Timer*  t   = pending.next;
+		listUnlink(t);
+		linkTimer(tw, t);
+	}
+}
+
+static
+void
+step(TimerWheel* tw) {
+	uint64_t    now     = ++tw->now;
+	uint32_t    top     = 0;
+
+	// cascade from the highest level that rolled over down to level 1
+	while( top + 1 < TIMER_WHEEL_LEVELS && (now & ((1ull << levelShift(top + 1)) - 1)) == 0 ) {
+		++top;
+	}
+	for( uint32_t level = top; level > 0; --level ) {
+		cascade(tw, level, (uint32_t)(now >> levelShift(level)) & TIMER_WHEEL_MASK);
+	}
+
+	// fire level 0, callbacks are free to insert or cancel any timer including
+	// the pending ones
+	uint32_t    slot    = (uint32_t)now & TIMER_WHEEL_MASK;
+	Timer       pending;
+	listMove(&pending, &tw->slots[0][slot]);
+	tw->occupied[0] &= ~(1ull << slot);
+
+	while( pending.next != &pending ) {
+		Timer*  t   = pending.next;
+		listUnlink(t);
+		if( t->period ) {
+			t->expiry   += t->period;
+			linkTimer(tw, t);
+		} else {
+			t->isArmed  = false;
+		}
+		t->callback(t);
+	}
+}
+
+TimerWheel*
+TimerWheel_init(TimerWheel* tw, uint64_t now) {
+	memset(tw, 0, sizeof(TimerWheel));
+	tw->now = now;
+	for( uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level ) {
+		for( uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot ) {
+			listInit(&tw->slots[level][slot]);
+		}
+	}
+	return tw;
+}
+
+void
+TimerWheel_insert(TimerWheel* tw, Timer* t) {
+	TimerWheel_cancel(tw, t);
+	if( t->expiry <= tw->now ) {
+		t->expiry   = tw->now + 1;
+	}
+	t->isArmed  = true;
+	linkTimer(tw, t);
+}
+
+void
+TimerWheel_cancel(TimerWheel* tw, Timer* t) {
+	if( !t->isArmed ) {
+		return;
+	}
+
+	listUnlink(t);
+	t->isArmed  = false;
+
+	Timer*  head    = bucketHead(tw, t->bucket);
+	if( head->next == head ) {
+		tw->occupied[t->bucket / TIMER_WHEEL_SLOTS] &= ~(1ull << (t->bucket % TIMER_WHEEL_SLOTS));
+	}
+}
+
+void
+TimerWheel_advance(TimerWheel* tw, uint64_t now) {
+	while( tw->now < now ) {
+		bool    isEmpty = true;
+		for( uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level ) {
+			isEmpty = isEmpty && tw->occupied[level] == 0;
+		}
+		if( isEmpty ) {
+			tw->now = now;
+			return;
+		}
+
+		// skip the empty level 0 slots, at most up to the end of the rotation
+		uint32_t    idx     = (uint32_t)tw->now & TIMER_WHEEL_MASK;
+		uint64_t    ahead   = idx == TIMER_WHEEL_MASK ? 0 : tw->occupied[0] >> (idx + 1);
+		uint64_t    skip    = ahead ? (uint64_t)__builtin_ctzll(ahead) : (uint64_t)(TIMER_WHEEL_MASK - idx);
+		if( tw->now + skip >= now ) {
+			tw->now = now;
+			return;
+		}
+		tw->now += skip;
+		step(tw);
+	}
+}
+
+uint64_t
+TimerWheel_nextExpiry(const TimerWheel* tw) {
+	uint64_t    next    = TIMER_NEVER;
+	for( uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level ) {
+		uint64_t    occupied    = tw->occupied[level];
+		if( occupied == 0 ) {
+			continue;
+		}
+
+		// rotate so that the slot following the current one is bit 0
+		uint64_t    base    = tw->now >> levelShift(level);
+		uint32_t    rot     = (uint32_t)(base + 1) & TIMER_WHEEL_MASK;
+		uint64_t    bits    = rot ? (occupied >> rot) | (occupied << (64 - rot)) : occupied;
+		uint64_t    tick    = (base + 1 + (uint64_t)__builtin_ctzll(bits)) << levelShift(level);
+
+		// level 0 slots are single ticks, higher levels give the cascade tick
+		next    = tick < next ? tick : next;
+	}
+	return next;
+}
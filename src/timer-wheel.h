@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchical Timer Wheel
+////////////////////////////////////////////////////////////////////////////////
+//
+// TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots, level L slots are
+// 64^L ticks wide. Timers are intrusive and kept in doubly linked slot lists so
+// insert and cancel are O(1), a timer moves down one level each time its slot
+// comes up (cascade) until it fires from level 0.
+//
+// The wheel is not thread safe, the owner serializes the calls.
+//
+
+#define TIMER_WHEEL_BITS    6
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS  4
+#define TIMER_WHEEL_SPAN    (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+#define TIMER_NEVER         UINT64_MAX
+
+typedef struct Timer Timer;
+
+typedef void (*TimerCallback)(Timer* timer);
+
+struct Timer {
+	Timer*          next;
+	Timer*          prev;
+	uint64_t        expiry;     // absolute tick
+	uint32_t        period;     // ticks between firings, 0: one shot
+	uint32_t        bucket;     // level * TIMER_WHEEL_SLOTS + slot
+	bool            isArmed;
+	TimerCallback   callback;   // called from TimerWheel_advance
+	void*           data;
+};
+
+typedef struct {
+	uint64_t        now;                                        // last processed tick
+	uint64_t        occupied[TIMER_WHEEL_LEVELS];               // non empty slots
+	Timer           slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];   // list heads
+} TimerWheel;
+
+TimerWheel*     TimerWheel_init(TimerWheel* tw, uint64_t now);
+
+/// arm the timer to fire at t->expiry (timers already due fire on the next tick)
+void            TimerWheel_insert(TimerWheel* tw, Timer* t);
+
+/// disarm the timer, does nothing if it is not armed
+void            TimerWheel_cancel(TimerWheel* tw, Timer* t);
+
+/// process all the ticks up to now, firing the due timers in order
+void            TimerWheel_advance(TimerWheel* tw, uint64_t now);
+
+//
+// earliest tick at which the wheel needs to be advanced
+// Return: TIMER_NEVER  -> no timer armed
+//
+uint64_t        TimerWheel_nextExpiry(const TimerWheel* tw);
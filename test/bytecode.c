@@ -0,0 +1,91 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// every instruction decodes to itself, truncated or invalid code is refused
+//
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/bytecode.h"
+#include "../src/module.h"
+
+#define RANDOM_COUNT    100000
+
+static
+void
+roundTrip(uint32_t ins, uint32_t expectedSize) {
+	uint8_t     code[BYTECODE_MAX_SIZE];
+	uint32_t    size    = Bytecode_encode(ins, code);
+	size_t      pos     = 0;
+	uint32_t    out     = 0;
+	assert(size <= BYTECODE_MAX_SIZE && (expectedSize == 0 || size == expectedSize));
+	assert(Bytecode_decode(code, size, &pos, &out) && pos == size && out == ins);
+
+	// one byte short
+	pos = 0;
+	assert(!Bytecode_decode(code, size - 1, &pos, &out));
+}
+
+int
+main(int argc, char* argv[]) {
+	roundTrip(0, 1);
+	roundTrip(63, 1);
+	roundTrip(64, 2);
+	roundTrip(0x7FFFFFFF, 6);
+	roundTrip(0x80000000 | 2, 1);
+	roundTrip(0x80000000 | 127, 1);
+	roundTrip(0x80000000 | 128, 3);
+	roundTrip(MODULE_REF(MODULE_SELF, 5), 2);
+	roundTrip(MODULE_REF(MODULE_EXTERN, 300), 3);
+	roundTrip(MODULE_REF(MODULE_SELF, MODULE_FUNCTION_MASK), 4);
+	roundTrip(MODULE_REF(42, 7), 0);
+
+	srand(1);
+	for( uint32_t i = 0; i < RANDOM_COUNT; ++i ) {
+		roundTrip(((uint32_t)rand() << 16) ^ (uint32_t)rand(), 0);
+	}
+
+	// a stream of instructions
+	uint32_t    ins[]   = { 1, 0x80000000 | 4, 1000, MODULE_REF(MODULE_SELF, 3), 0x80000000 | 70000 };
+	uint32_t    count   = sizeof(ins) / sizeof(ins[0]);
+	uint8_t     code[sizeof(ins) * 2];
+	uint32_t    size    = 0;
+	for( uint32_t i = 0; i < count; ++i ) {
+		size    += Bytecode_encode(ins[i], &code[size]);
+	}
+	assert(size == Bytecode_size(ins, count));
+	size_t      pos     = 0;
+	for( uint32_t i = 0; i < count; ++i ) {
+		uint32_t    out;
+		assert(Bytecode_decode(code, size, &pos, &out) && out == ins[i]);
+	}
+	assert(pos == size);
+
+	// unknown tag, function past the module format, leb128 past 32 bits
+	uint8_t     badTag[]    = { 0xC5, 0 };
+	uint8_t     badFunc[]   = { 0xC3, 0xFF, 0xFF, 0x7F };
+	uint8_t     badLeb[]    = { 0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+	uint32_t    out;
+	pos = 0;    assert(!Bytecode_decode(badTag,  sizeof(badTag),  &pos, &out));
+	pos = 0;    assert(!Bytecode_decode(badFunc, sizeof(badFunc), &pos, &out));
+	pos = 0;    assert(!Bytecode_decode(badLeb,  sizeof(badLeb),  &pos, &out));
+
+	fprintf(stdout, "bytecode: ok\n");
+	return 0;
+}
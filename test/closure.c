@@ -0,0 +1,87 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// closures run through call and cond like lambdas, read their captures with
+// clo.read and keep them across nested calls
+//
+
+#include <assert.h>
+#include "vm-fixture.h"
+
+int
+main(int argc, char* argv[]) {
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	addProbes(vm);
+
+	// captured in order, v0 is the deepest value
+	eval(proc, ": mul 6 7 2 { 0 clo.read 10 u32.mul 1 clo.read u32.add test.probe } clo.new ;");
+	eval(proc, "mul vs.dup call clo.free");
+	assert(probed == 67 && proc->vsCount == 0 && proc->closure == NULL);
+
+	// both branches of cond, a closure (local 0) and a lambda
+	eval(proc, ": pick 11 1 { 0 clo.read test.probe } clo.new ; pick ls.push");
+	eval(proc, "1 0 ls.read { 22 test.probe } cond");
+	assert(probed == 11);
+	eval(proc, "0 0 ls.read { 22 test.probe } cond");
+	assert(probed == 22);
+	eval(proc, "0 { 33 test.probe } 0 ls.read cond");
+	assert(probed == 11 && proc->vsCount == 0);
+
+	// the outer closure reads its captures again once the inner one returned
+	eval(proc, ": inner 100 1 { 0 clo.read } clo.new ;");
+	eval(proc, ": outer inner 5 2 { 0 clo.read call 1 clo.read u32.add test.probe 0 clo.read clo.free } clo.new ;");
+	eval(proc, "outer vs.dup call clo.free");
+	assert(probed == 105 && proc->closure == NULL);
+
+	// lambdas run inside a closure read its captures
+	eval(proc, ": nested 8 1 { 1 { 0 clo.read test.probe } { 0 test.probe } cond } clo.new ;");
+	eval(proc, "nested vs.dup call clo.free");
+	assert(probed == 8 && proc->closure == NULL);
+
+	// one closure per iteration
+	eval(proc, ": loop vs.dup 0 u32.eq { vs.drop } { vs.dup 1 { 0 clo.read test.add } clo.new vs.dup call clo.free 1 u32.sub loop } cond ;");
+	eval(proc, "1000 loop");
+	assert(sum == 500500 && proc->vsCount == 0);
+
+	// a closure stays with its process
+	eval(proc, "16 0 ls.read spawn test.probe 0 ls.read clo.free");
+	assert(probed == 0 && proc->vsCount == 0);
+
+	// misuse aborts the word instead of reading past the stack or the captures,
+	// the repl clears the values and goes on with the rest of the line
+	probed  = 1;
+	eval(proc, "1 2 99 { 5 test.probe } clo.new vs.size test.probe");
+	assert(probed == 0 && proc->exceptFlags.all == 0);
+	probed  = 1;
+	eval(proc, "7 1 0 { } clo.new clo.new vs.size test.probe");
+	assert(probed == 0);
+	probed  = 1;
+	eval(proc, "0 100000 clo.new vs.size test.probe");
+	assert(probed == 0);
+	probed  = 1;
+	eval(proc, "0 clo.read vs.size test.probe");
+	assert(probed == 0);
+	probed  = 1;
+	eval(proc, "9 1 { 3 clo.read } clo.new call vs.size test.probe");
+	assert(probed == 0 && proc->closure == NULL && proc->vsCount == 0);
+
+	releaseVM(vm, proc);
+	fprintf(stdout, "closure: ok\n");
+	return 0;
+}
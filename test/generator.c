@@ -0,0 +1,84 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// generators run their lambda on stacks of their own and hand values back with
+// gen.yield from any call depth, a generator may resume another one
+//
+
+#include <assert.h>
+#include "vm-fixture.h"
+
+int
+main(int argc, char* argv[]) {
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	addProbes(vm);
+
+	// yields from a nested word, then 0 0 once the lambda returned
+	eval(proc, ": y gen.yield ; : three { 1 y 2 y 3 gen.yield } gen.new ;");
+	eval(proc, "three ls.push");
+	eval(proc, "0 ls.read gen.next test.probe test.probe");
+	assert(probed == 1 && proc->gen == NULL);
+	eval(proc, "0 ls.read gen.next test.probe test.add 0 ls.read gen.next test.probe test.add");
+	assert(probed == 1 && sum == 5);
+	eval(proc, "0 ls.read gen.next test.probe test.add 0 ls.read gen.next test.probe test.add");
+	assert(probed == 0 && sum == 5 && proc->vsCount == 0);
+	eval(proc, "0 ls.read gen.free");
+	assert(proc->gens == NULL);
+
+	// generators over a closure keep their own state
+	eval(proc, ": count vs.dup 0 clo.read u32.lt { vs.dup gen.yield 1 u32.add count } { vs.drop } cond ;");
+	eval(proc, ": upto 1 { 0 count } clo.new gen.new ;");
+	eval(proc, ": drain vs.dup gen.next { test.add drain } { vs.drop gen.free } cond ;");
+	sum = 0;
+	eval(proc, "100 upto drain");
+	assert(sum == 4950 && proc->vsCount == 0 && proc->gens == NULL);
+
+	// interleaved, each one goes on from its own yield
+	sum = 0;
+	eval(proc, "3 upto ls.push 5 upto ls.push");
+	eval(proc, "1 ls.read gen.next vs.drop test.add 2 ls.read gen.next vs.drop test.add 1 ls.read gen.next vs.drop test.add");
+	assert(sum == 1);
+	eval(proc, "1 ls.read drain 2 ls.read drain");
+	assert(sum == 1 + 2 + 10 && proc->vsCount == 0 && proc->gens == NULL);
+
+	// a generator draining another one, its values double
+	eval(proc, ": dbl vs.dup gen.next { 2 u32.mul gen.yield dbl } { vs.drop gen.free } cond ;");
+	sum = 0;
+	eval(proc, "{ 5 upto dbl } gen.new drain");
+	assert(sum == 20 && proc->vsCount == 0 && proc->gens == NULL);
+
+	// an overflow kills the word, the repl is back on its own stacks
+	eval(proc, ": deep 1 deep ; { deep } gen.new ls.push 3 ls.read gen.next");
+	assert(proc->gen == NULL && proc->vsCount == 0);
+	eval(proc, "3 ls.read gen.next test.probe test.probe 3 ls.read gen.free");
+	assert(probed == 0 && proc->gens == NULL);
+
+	// outside of a generator a yield drops its value
+	eval(proc, "7 gen.yield");
+	assert(proc->vsCount == 0);
+
+	// a generator of no function aborts the word
+	probed  = 1;
+	eval(proc, "4000000000 gen.new vs.size test.probe");
+	assert(probed == 0 && proc->gens == NULL);
+
+	releaseVM(vm, proc);
+	fprintf(stdout, "generator: ok\n");
+	return 0;
+}
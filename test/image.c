@@ -0,0 +1,155 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// an image saved by one VM runs in another one, natives bound by name. A shaken
+// image only holds the words reachable from its roots, a compact one is decoded
+//
+
+#include <assert.h>
+#include <unistd.h>
+#include "vm-fixture.h"
+
+#define IMAGE_PATH      "test-image.img"
+#define SHAKEN_PATH     "test-image-shaken.img"
+
+static
+void
+checkCompact() {
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	eval(proc, ": big 3000000001 ; : run big 1 u32.add test.probe ;");
+	uint32_t    insCount    = vm->insCount;
+	assert(vmImageSave(vm, IMAGE_PATH, true));
+	releaseVM(vm, proc);
+
+	vm  = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	eval(proc, ": a 1 ; : b 2 ; : c 3 ;");
+	assert(vmImageLoad(vm, IMAGE_PATH) && vm->insCount == insCount);
+	eval(proc, "run");
+	assert(probed == 3000000002u);
+	releaseVM(vm, proc);
+	unlink(IMAGE_PATH);
+}
+
+static
+void
+checkShake() {
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	uint32_t    natives = vm->funcCount;
+	eval(proc, ": sq vs.dup u32.mul ; : apply { sq } call ; : run 5 apply test.probe ; : sq 0 ; : unused 1 ;");
+	uint32_t    run     = vmFindFunction(vm, "run") - 1;
+	assert(vmImageShake(vm, SHAKEN_PATH, &run, 1, true));
+	releaseVM(vm, proc);
+
+	// run, apply, its lambda and the shadowed sq are left
+	vm  = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	assert(vmImageLoad(vm, SHAKEN_PATH));
+	assert(vm->funcCount == natives + 4 && vmFindFunction(vm, "unused") == 0 && vm->relocCount == 1);
+	eval(proc, "run");
+	assert(probed == 25);
+
+	// a shaken image can be shaken again, its literals are still known
+	run = vmFindFunction(vm, "run") - 1;
+	assert(vmImageShake(vm, SHAKEN_PATH, &run, 1, true));
+	releaseVM(vm, proc);
+
+	vm  = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	assert(vmImageLoad(vm, SHAKEN_PATH) && vm->funcCount == natives + 4);
+	probed  = 0;
+	eval(proc, "run");
+	assert(probed == 25);
+	releaseVM(vm, proc);
+	unlink(SHAKEN_PATH);
+}
+
+// the code of a long word spans whole pages, they are mapped from the image
+static
+void
+checkSaveOver() {
+	static char src[4096 * 10 + 32];
+	size_t      len     = (size_t)sprintf(src, ": long ");
+	for( uint32_t i = 0; i < 4096; ++i ) {
+		len += (size_t)sprintf(src + len, "1 vs.drop ");
+	}
+	sprintf(src + len, "7 test.probe ;");
+
+	VMParameters    params  = testParameters();
+	params.maxCISCount  = 16384;
+	Process*    proc;
+	VM*         vm      = newVMWith(&params, &proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	eval(proc, src);
+	assert(vmImageSave(vm, IMAGE_PATH, false));
+	releaseVM(vm, proc);
+
+	// a compact image is smaller, saving it over the one mapped leaves it running
+	vm  = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	assert(vmImageLoad(vm, IMAGE_PATH) && vmImageSave(vm, IMAGE_PATH, true));
+	probed  = 0;
+	eval(proc, "long");
+	assert(probed == 7);
+	releaseVM(vm, proc);
+	unlink(IMAGE_PATH);
+}
+
+int
+main(int argc, char* argv[]) {
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	eval(proc, ": sq vs.dup u32.mul ; : run 7 sq test.probe ;");
+	uint32_t    funcCount   = vm->funcCount;
+	assert(vmImageSave(vm, IMAGE_PATH, false));
+	releaseVM(vm, proc);
+
+	// the probe native is registered in a different slot
+	vm  = newVM(&proc);
+	vmAddNativeFunction(vm, "other", false, probe, 0, 0);
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	eval(proc, ": unrelated 1 ;");
+	assert(vmImageLoad(vm, IMAGE_PATH));
+	assert(vm->funcCount == funcCount && vmFindFunction(vm, "unrelated") == 0);
+	eval(proc, "run");
+	assert(probed == 49);
+
+	// words compiled after the load grow the mapped segments
+	eval(proc, ": run2 sq sq test.probe ; 3 run2");
+	assert(probed == 81);
+	releaseVM(vm, proc);
+
+	// an image naming a native the VM lacks is refused and leaves the VM intact
+	vm  = newVM(&proc);
+	uint32_t    natives = vm->funcCount;
+	assert(!vmImageLoad(vm, IMAGE_PATH));
+	assert(vm->funcCount == natives);
+	releaseVM(vm, proc);
+
+	unlink(IMAGE_PATH);
+	checkCompact();
+	checkShake();
+	checkSaveOver();
+	fprintf(stdout, "image: ok\n");
+	return 0;
+}
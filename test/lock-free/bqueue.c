@@ -16,6 +16,7 @@
 */
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <assert.h>
 #include "../../src/lock-free/lock-free.h"
@@ -30,7 +31,7 @@ producer0(void* _bq) {
     for( size_t i = 1; i < 1024 * MAX_QUEUE_SIZE; ++i ) {
         while(BoundedQueue_push(bq, (void*)i) == false) {
             fprintf(stderr, "-- producer0 yielded (%u) --\n", i);
-            pthread_yield();
+            sched_yield();
         }
         sum += i;
     }
@@ -47,7 +48,7 @@ producer1(void* _bq) {
     for( size_t i = 1024 * MAX_QUEUE_SIZE; i < 2048 * MAX_QUEUE_SIZE; ++i ) {
         while( BoundedQueue_push(bq, (void*)i) == false) {
             fprintf(stderr, "-- producer1 yielded (%u) --\n", i);
-            pthread_yield();
+            sched_yield();
         }
         sum += i;
     }
@@ -71,7 +72,7 @@ consumer0(void* _bq) {
                 succeeded   = true;
             } else {
                 fprintf(stderr, "-- consumer0 yielded (%u) --\n", i);
-                pthread_yield();
+                sched_yield();
             }
         }
     }
@@ -96,7 +97,7 @@ consumer1(void* _bq) {
                 succeeded   = true;
             } else {
                 fprintf(stderr, "-- consumer1 yielded (%u) --\n", i);
-                pthread_yield();
+                sched_yield();
             }
         }
     }
@@ -105,6 +106,65 @@ consumer1(void* _bq) {
     return (void*)sum;
 }
 
+#define BATCH_COUNT         7
+#define BATCH_ITEMS         (1024 * MAX_QUEUE_SIZE)
+
+void*
+batchProducer(void* _bq) {
+    BoundedQueue*   bq  = _bq;
+    void*           items[BATCH_COUNT];
+
+    size_t  sum = 0;
+    for( size_t i = 1; i < BATCH_ITEMS; ) {
+        uint32_t    count   = 0;
+        for( ; count < BATCH_COUNT && i + count < BATCH_ITEMS; ++count ) {
+            items[count]    = (void*)(i + count);
+        }
+
+        uint32_t    pushed  = 0;
+        while( pushed < count ) {
+            uint32_t    n   = BoundedQueue_pushN(bq, items + pushed, count - pushed);
+            if( n == 0 ) {
+                sched_yield();
+            }
+            pushed  += n;
+        }
+
+        for( uint32_t j = 0; j < count; ++j ) {
+            sum += i + j;
+        }
+        i   += count;
+    }
+
+    fprintf(stderr, "**** batch producer sum: %u ****\n", sum);
+    return (void*)sum;
+}
+
+void*
+batchConsumer(void* _bq) {
+    BoundedQueue*   bq  = _bq;
+    void*           items[BATCH_COUNT];
+
+    size_t  sum     = 0;
+    size_t  last    = 0;
+    for( size_t got = 1; got < BATCH_ITEMS; ) {
+        uint32_t    n   = BoundedQueue_popN(bq, items, BATCH_COUNT);
+        if( n == 0 ) {
+            sched_yield();
+        }
+        for( uint32_t j = 0; j < n; ++j ) {
+            // single producer, the order must be kept
+            assert( (size_t)items[j] == last + 1 );
+            last    = (size_t)items[j];
+            sum += last;
+        }
+        got += n;
+    }
+
+    fprintf(stderr, "**** batch consumer sum: %u ****\n", sum);
+    return (void*)sum;
+}
+
 int
 main(int argc, char* argv[]) {
 
@@ -142,6 +202,23 @@ main(int argc, char* argv[]) {
         fprintf(stderr, "FAIL!!!\n");
     }
 
+    BoundedQueue_release(&q);
+
+    // batches, the capacity is not a multiple of the batch size
+    pthread_t   bprod, bcons;
+    size_t      sbprod  = 0;
+    size_t      sbcons  = 0;
+    BoundedQueue_init(&q, MAX_QUEUE_SIZE);
+    pthread_create(&bprod, NULL, batchProducer, &q);
+    pthread_create(&bcons, NULL, batchConsumer, &q);
+    pthread_join(bprod, (void**)&sbprod);
+    pthread_join(bcons, (void**)&sbcons);
+    assert( sbprod == sbcons );
+
+    if( sbprod != sbcons ) {
+        fprintf(stderr, "FAIL!!!\n");
+    }
+
     BoundedQueue_release(&q);
     return 0;
 }
@@ -0,0 +1,111 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <assert.h>
+#include "../../src/lock-free/lock-free.h"
+
+#define MAX_QUEUE_SIZE      30      // rounded up to 32
+#define ITEM_COUNT          (4096 * MAX_QUEUE_SIZE)
+#define BATCH_COUNT         5
+
+void*
+producer(void* _q) {
+    SpscQueue*  q   = _q;
+    void*       items[BATCH_COUNT];
+
+    size_t  sum = 0;
+    for( size_t i = 1; i < ITEM_COUNT; ) {
+        // alternate single pushes and batches
+        uint32_t    count   = (i & 1) ? 1 : BATCH_COUNT;
+        count   = i + count <= ITEM_COUNT ? count : (uint32_t)(ITEM_COUNT - i);
+        for( uint32_t j = 0; j < count; ++j ) {
+            items[j]    = (void*)(i + j);
+        }
+
+        uint32_t    pushed  = 0;
+        while( pushed < count ) {
+            uint32_t    n   = count - pushed == 1
+                            ? (SpscQueue_push(q, items[pushed]) ? 1 : 0)
+                            : SpscQueue_pushN(q, items + pushed, count - pushed);
+            if( n == 0 ) {
+                sched_yield();
+            }
+            pushed  += n;
+        }
+
+        for( uint32_t j = 0; j < count; ++j ) {
+            sum += i + j;
+        }
+        i   += count;
+    }
+
+    fprintf(stderr, "**** producer sum: %u ****\n", sum);
+    return (void*)sum;
+}
+
+void*
+consumer(void* _q) {
+    SpscQueue*  q   = _q;
+    void*       items[BATCH_COUNT];
+
+    size_t  sum     = 0;
+    size_t  last    = 0;
+    for( size_t got = 1; got < ITEM_COUNT; ) {
+        uint32_t    n   = (got & 2) ? SpscQueue_popN(q, items, BATCH_COUNT)
+                                    : ((items[0] = SpscQueue_pop(q)) != NULL ? 1 : 0);
+        if( n == 0 ) {
+            sched_yield();
+        }
+        for( uint32_t j = 0; j < n; ++j ) {
+            assert( (size_t)items[j] == last + 1 );
+            last    = (size_t)items[j];
+            sum += last;
+        }
+        got += n;
+    }
+
+    fprintf(stderr, "**** consumer sum: %u ****\n", sum);
+    return (void*)sum;
+}
+
+int
+main(int argc, char* argv[]) {
+    pthread_t   prod, cons;
+    SpscQueue   q;
+    SpscQueue_init(&q, MAX_QUEUE_SIZE);
+    assert( q.mask + 1 == 32 );
+
+    size_t  sprod   = 0;
+    size_t  scons   = 0;
+    pthread_create(&prod, NULL, producer, &q);
+    pthread_create(&cons, NULL, consumer, &q);
+    pthread_join(prod, (void**)&sprod);
+    pthread_join(cons, (void**)&scons);
+
+    assert( sprod == scons );
+    assert( SpscQueue_pop(&q) == NULL );
+
+    if( sprod != scons ) {
+        fprintf(stderr, "FAIL!!!\n");
+    }
+
+    SpscQueue_release(&q);
+    return 0;
+}
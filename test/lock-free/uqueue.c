@@ -16,6 +16,7 @@
 */
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <assert.h>
 #include "../../src/lock-free/lock-free.h"
@@ -94,7 +95,7 @@ consumer0(void* _bq) {
                 succeeded   = true;
             } else {
                 fprintf(stderr, "-- consumer0 yielded (%u) --\n", i);
-                pthread_yield();
+                sched_yield();
             }
         }
     }
@@ -119,7 +120,7 @@ consumer1(void* _bq) {
                 succeeded   = true;
             } else {
                 fprintf(stderr, "-- consumer1 yielded (%u) --\n", i);
-                pthread_yield();
+                sched_yield();
             }
         }
     }
@@ -0,0 +1,131 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// load caches a source file as a module and links it at another base in the
+// next VM, lambdas and word addresses included. The words of a module are only
+// materialized when called
+//
+
+#include <assert.h>
+#include <unistd.h>
+#include "vm-fixture.h"
+
+#define SOURCE_PATH     "test-module.ncvm"
+#define MODULE_PATH     "test-module.ncvmc"
+#define EFFECT_PATH     "test-module-effect.ncvm"
+#define IMAGE_PATH      "test-module.img"
+
+static
+void
+writeFile(const char* path, const char* text) {
+	FILE*   f   = fopen(path, "w");
+	assert(f);
+	fputs(text, f);
+	fclose(f);
+}
+
+// Return: true if path exists
+static
+bool
+exists(const char* path) {
+	return access(path, F_OK) == 0;
+}
+
+static
+void
+checkCache() {
+	writeFile(SOURCE_PATH,
+	          "// squares through a lambda and a word address\n"
+	          ": sq vs.dup u32.mul ;\n"
+	          ": apply { sq } call ;\n"
+	          ": apply2 @ sq call ;\n"
+	          ": run 7 apply apply2 test.probe ;\n"
+	          ": unused 1 ;\n");
+	unlink(MODULE_PATH);
+
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	addProbes(vm);
+	vmLoad(proc, SOURCE_PATH);
+	eval(proc, "run");
+	assert(probed == 2401 && exists(MODULE_PATH));
+	uint32_t    funcs   = vm->funcCount;
+	// the lambda of apply is the only function out of the dictionary
+	assert(vm->wordCount == funcs - 1);
+	releaseVM(vm, proc);
+
+	// the module lands two functions further, the literals follow
+	vm  = newVM(&proc);
+	addProbes(vm);
+	eval(proc, ": pad1 1 ; : pad2 2 ;");
+	uint32_t    cisBefore   = vm->compilerState.cisCount;
+	uint32_t    insBefore   = vm->insCount;
+	vmLoad(proc, SOURCE_PATH);
+	assert(vm->funcCount == funcs + 2 && vm->compilerState.cisCount == cisBefore);
+	assert(vm->insCount == insBefore && vm->modules.lazyCount == 6 && vm->modules.materialized == 0);
+	probed  = 0;
+	eval(proc, "run");
+	assert(probed == 2401);
+
+	// sq, apply, its lambda, apply2 and run, unused is left in the module
+	uint32_t    unused  = vmFindFunction(vm, "unused") - 1;
+	uint32_t    lambda  = vmFindFunction(vm, "apply");
+	assert(vm->funcs[lambda].nameOffset == VM_NO_NAME && vm->wordCount == vm->funcCount - 1);
+	assert(vm->modules.materialized == 5 && vm->funcs[unused].type == FT_LAZY);
+
+	// an image holds every word, materialized
+	assert(vmImageSave(vm, IMAGE_PATH, false));
+	assert(vm->modules.materialized == 6 && vm->funcs[unused].type == FT_INTERP);
+	releaseVM(vm, proc);
+	unlink(IMAGE_PATH);
+
+	// a VM lacking an external word compiles the source again
+	vm      = newVM(&proc);
+	uint32_t    natives = vm->funcCount;
+	assert(!vmModuleLoad(proc, MODULE_PATH, 0));
+	uint64_t    hash;
+	assert(vmModuleHash(SOURCE_PATH, &hash) && !vmModuleLoad(proc, MODULE_PATH, hash));
+	assert(vm->funcCount == natives && vm->insCount == 0);
+	releaseVM(vm, proc);
+
+	unlink(SOURCE_PATH);
+	unlink(MODULE_PATH);
+}
+
+static
+void
+checkEffects() {
+	writeFile(EFFECT_PATH, ": five 5 ;\n5 test.probe\n");
+	unlink(EFFECT_PATH "c");
+
+	Process*    proc;
+	VM*         vm      = newVM(&proc);
+	addProbes(vm);
+	vmLoad(proc, EFFECT_PATH);
+	assert(probed == 5 && !exists(EFFECT_PATH "c"));
+	releaseVM(vm, proc);
+	unlink(EFFECT_PATH);
+}
+
+int
+main(int argc, char* argv[]) {
+	checkCache();
+	checkEffects();
+	fprintf(stdout, "module: ok\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// the function, code and char segments grow past the old fixed caps, and stop
+// with fnOF/insOF/chOF at their hard limits without writing past them
+//
+
+#include <assert.h>
+#include "vm-fixture.h"
+
+#define WORD_COUNT      20000
+
+static
+VM*
+newSegmentsVM(uint32_t funCap, uint32_t insCap, uint32_t charCap, Process** proc) {
+	VMParameters    params  = testParameters();
+	params.maxFunctionCount     = funCap;
+	params.maxInstructionCount  = insCap;
+	params.maxCharSegmentSize   = charCap;
+	return newVMWith(&params, proc);
+}
+
+static
+void
+checkGrowth() {
+	Process*    proc;
+	VM*         vm      = newSegmentsVM(0, 0, 0, &proc);
+
+	// well past the 4096 functions/65536 instructions main.c used to cap at
+	char        src[64];
+	for( uint32_t w = 0; w < WORD_COUNT; ++w ) {
+		sprintf(src, ": word%u %u 1 2 3 ;", w, w);
+		eval(proc, src);
+	}
+
+	uint32_t    first   = vmFindFunction(vm, "word0") - 1;
+	uint32_t    last    = vmFindFunction(vm, "word19999") - 1;
+	assert(first != VM_NO_FUNCTION && last != VM_NO_FUNCTION);
+	assert(vm->funcs[last].u.interp.insCount == 4);
+	assert(vm->ins[vm->funcs[last].u.interp.insOffset] == WORD_COUNT - 1);
+	assert(vm->ins[vm->funcs[first].u.interp.insOffset] == 0);
+	assert(proc->exceptFlags.all == 0);
+	releaseVM(vm, proc);
+}
+
+static
+void
+checkLimits() {
+	Process*    proc;
+	VM*         vm      = newSegmentsVM(0, 0, 0, &proc);
+	uint32_t    natives = vm->funcCount;
+	uint32_t    chars   = vm->charCount;
+	uint32_t    ins     = vm->insCount;
+	releaseVM(vm, proc);
+
+	// function segment: room for one more
+	vm  = newSegmentsVM(natives + 1, 0, 0, &proc);
+	assert(vmAllocateInterpFunction(proc, "a") == natives);
+	assert(vmAllocateInterpFunction(proc, "b") == VM_NO_FUNCTION);
+	assert(proc->exceptFlags.indiv.fnOF && vm->funcCount == natives + 1);
+	releaseVM(vm, proc);
+
+	// char segment: "abc" fits, "defgh" does not
+	vm  = newSegmentsVM(0, 0, chars + 4, &proc);
+	assert(vmAllocateInterpFunction(proc, "abc") == natives);
+	uint32_t    charCount   = vm->charCount;
+	assert(vmAllocateInterpFunction(proc, "defgh") == VM_NO_FUNCTION);
+	assert(proc->exceptFlags.indiv.chOF && vm->charCount == charCount);
+	releaseVM(vm, proc);
+
+	// code segment: a body that does not fit is dropped as a whole
+	vm  = newSegmentsVM(0, ins + 4, 0, &proc);
+	eval(proc, ": fits 1 2 3 ; : big 1 2 3 4 5 ;");
+	uint32_t    fits    = vmFindFunction(vm, "fits") - 1;
+	uint32_t    big     = vmFindFunction(vm, "big") - 1;
+	assert(vm->funcs[fits].u.interp.insCount == 3);
+	assert(vm->funcs[big].u.interp.insCount == 0 && vm->insCount == ins + 3);
+	assert(vmPushInstruction(proc, 7) && !vmPushInstruction(proc, 8));
+	assert(proc->exceptFlags.indiv.insOF && vm->insCount == ins + 4);
+	releaseVM(vm, proc);
+}
+
+int
+main(int argc, char* argv[]) {
+	checkGrowth();
+	checkLimits();
+	fprintf(stdout, "segments: ok\n");
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "../src/slab.h"
+#include "../src/lock-free/lock-free.h"
+
+#define THREAD_COUNT    4
+#define ROUND_COUNT     200000
+#define LIVE_COUNT      256
+#define LARGE_EVERY     997
+
+//
+// every thread keeps a window of live blocks of random sizes, stamped with
+// their owner and size. Every other block is handed to the next thread which
+// checks and frees it (remote free), the rest are checked and freed locally.
+//
+
+typedef struct {
+	uint32_t    size;
+	uint32_t    seed;
+} Stamp;
+
+static BoundedQueue     handoff[THREAD_COUNT];
+static atomic_uint      doneCount;
+static atomic_ulong     errors;
+
+static
+void*
+stamp(uint32_t size, uint32_t seed) {
+	uint8_t*    p   = Slab_alloc(size);
+	if( p == NULL || ((uintptr_t)p & 15) != 0 || Slab_size(p) < size ) {
+		atomic_fetch_add(&errors, 1);
+		return NULL;
+	}
+	((Stamp*)p)->size   = size;
+	((Stamp*)p)->seed   = seed;
+	for( uint32_t i = sizeof(Stamp); i < size; ++i ) {
+		p[i]    = (uint8_t)(seed + i);
+	}
+	return p;
+}
+
+static
+void
+checkAndFree(void* ptr) {
+	uint8_t*    p       = ptr;
+	Stamp       s       = *(Stamp*)p;
+	for( uint32_t i = sizeof(Stamp); i < s.size; ++i ) {
+		if( p[i] != (uint8_t)(s.seed + i) ) {
+			fprintf(stderr, "block %p of %u bytes corrupted at %u\n", ptr, s.size, i);
+			atomic_fetch_add(&errors, 1);
+			break;
+		}
+	}
+	Slab_free(p);
+}
+
+static
+void
+drain(BoundedQueue* q) {
+	void*   p;
+	while( (p = BoundedQueue_pop(q)) != NULL ) {
+		checkAndFree(p);
+	}
+}
+
+static
+void*
+worker(void* arg) {
+	uint32_t    id      = (uint32_t)(uintptr_t)arg;
+	uint32_t    seed    = id * 7919 + 1;
+	void*       live[LIVE_COUNT]    = { NULL };
+
+	for( uint32_t r = 0; r < ROUND_COUNT; ++r ) {
+		seed    = seed * 1103515245 + 12345;
+		uint32_t    slot    = (seed >> 8) % LIVE_COUNT;
+		uint32_t    size    = sizeof(Stamp) + (seed >> 16) % 2048;
+		if( r % LARGE_EVERY == 0 ) {
+			size    += SLAB_MAX_SMALL * (1 + r % 3);
+		}
+
+		if( live[slot] ) {
+			if( r & 1 ) {
+				while( !BoundedQueue_push(&handoff[(id + 1) % THREAD_COUNT], live[slot]) ) {
+					drain(&handoff[id]);
+					sched_yield();
+				}
+			} else {
+				checkAndFree(live[slot]);
+			}
+		}
+		live[slot]  = stamp(size, seed);
+		drain(&handoff[id]);
+	}
+
+	for( uint32_t i = 0; i < LIVE_COUNT; ++i ) {
+		if( live[i] ) {
+			checkAndFree(live[i]);
+		}
+	}
+
+	// keep draining until every thread stopped handing blocks over
+	atomic_fetch_add(&doneCount, 1);
+	while( atomic_load(&doneCount) < THREAD_COUNT ) {
+		drain(&handoff[id]);
+		sched_yield();
+	}
+	return NULL;
+}
+
+// region blocks are zeroed, ignored by Slab_free and copied out by promotion
+static
+void
+checkRegion() {
+	SlabRegion  region  = { 0 };
+	uint8_t*    kept    = NULL;
+
+	for( uint32_t i = 0; i < 10000; ++i ) {
+		uint32_t    size    = 1 + (i * 37) % 3000 + (i % 101 == 0 ? 100000 : 0);
+		uint8_t*    p       = SlabRegion_alloc(&region, size);
+		if( p == NULL || ((uintptr_t)p & 15) != 0 || !Slab_isRegion(p) || p[0] != 0 || p[size - 1] != 0 ) {
+			atomic_fetch_add(&errors, 1);
+			continue;
+		}
+		memset(p, (int)i, size);
+		Slab_free(p);
+		if( i == 500 ) {
+			kept    = Slab_promote(p, size);
+		}
+	}
+	SlabRegion_release(&region);
+
+	if( kept == NULL || Slab_isRegion(kept) || kept[0] != (uint8_t)500 || region.chunks != NULL ) {
+		atomic_fetch_add(&errors, 1);
+	}
+	Slab_free(kept);
+}
+
+int
+main(int argc, char* argv[]) {
+	pthread_t   threads[THREAD_COUNT];
+
+	for( uint32_t t = 0; t < THREAD_COUNT; ++t ) {
+		BoundedQueue_init(&handoff[t], 1024);
+	}
+	for( uintptr_t t = 0; t < THREAD_COUNT; ++t ) {
+		pthread_create(&threads[t], NULL, worker, (void*)t);
+	}
+	for( uint32_t t = 0; t < THREAD_COUNT; ++t ) {
+		pthread_join(threads[t], NULL);
+	}
+	for( uint32_t t = 0; t < THREAD_COUNT; ++t ) {
+		drain(&handoff[t]);
+		BoundedQueue_release(&handoff[t]);
+	}
+
+	checkRegion();
+
+	// the main thread adopts a heap left by a worker, its spans must still be usable
+	void*   p   = stamp(100, 3);
+	checkAndFree(p);
+
+	if( atomic_load(&errors) ) {
+		fprintf(stderr, "FAIL!!!\n");
+		return 1;
+	}
+	fprintf(stderr, "**** %u threads x %u blocks checked ****\n", THREAD_COUNT, ROUND_COUNT);
+	return 0;
+}
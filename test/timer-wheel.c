@@ -0,0 +1,104 @@
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "../src/timer-wheel.h"
+
+#define TIMER_COUNT     20000
+#define MAX_DELAY       (1 << 20)
+
+static TimerWheel   tw;
+static Timer        timers[TIMER_COUNT];
+static uint64_t     fireCount[TIMER_COUNT];
+static uint64_t     errors  = 0;
+
+static
+void
+onFire(Timer* t) {
+	uintptr_t   idx = (uintptr_t)t->data;
+	// periodic timers were already re-armed for their next period
+	uint64_t    due = t->period ? t->expiry - t->period : t->expiry;
+	if( due != tw.now ) {
+		fprintf(stderr, "timer %u fired at %lu instead of %lu\n", (uint32_t)idx, (unsigned long)tw.now, (unsigned long)due);
+		++errors;
+	}
+	++fireCount[idx];
+}
+
+int
+main(int argc, char* argv[]) {
+	TimerWheel_init(&tw, 12345);
+	srand(42);
+
+	uint64_t    last    = 0;
+	for( uintptr_t i = 0; i < TIMER_COUNT; ++i ) {
+		timers[i].expiry    = tw.now + 1 + (uint64_t)(rand() % MAX_DELAY);
+		timers[i].callback  = onFire;
+		timers[i].data      = (void*)i;
+		TimerWheel_insert(&tw, &timers[i]);
+		last    = timers[i].expiry > last ? timers[i].expiry : last;
+	}
+
+	// a quarter is cancelled, one is periodic
+	for( uint32_t i = 0; i < TIMER_COUNT; i += 4 ) {
+		TimerWheel_cancel(&tw, &timers[i]);
+	}
+	timers[1].period    = 1000;
+	uint64_t    firstPeriodic   = timers[1].expiry;
+
+	// advance in uneven strides, the next expiry must never be later than the
+	// earliest armed timer
+	uint64_t    end = last + 10;
+	while( tw.now < end ) {
+		uint64_t    next    = TimerWheel_nextExpiry(&tw);
+		uint64_t    earliest= TIMER_NEVER;
+		for( uint32_t i = 0; i < TIMER_COUNT; ++i ) {
+			if( timers[i].isArmed && timers[i].expiry < earliest ) {
+				earliest    = timers[i].expiry;
+			}
+		}
+		if( next <= tw.now || next > earliest ) {
+			fprintf(stderr, "next expiry %lu, earliest timer %lu\n", (unsigned long)next, (unsigned long)earliest);
+			++errors;
+		}
+		uint64_t    target  = tw.now + 1 + (uint64_t)(rand() % 5000);
+		TimerWheel_advance(&tw, target < end ? target : end);
+	}
+
+	for( uint32_t i = 0; i < TIMER_COUNT; ++i ) {
+		uint64_t    expected    = (i % 4 == 0) ? 0 : 1;
+		if( i == 1 ) {
+			expected    = (end - firstPeriodic) / timers[1].period + 1;
+		}
+		if( fireCount[i] != expected ) {
+			fprintf(stderr, "timer %u fired %lu times instead of %lu\n", i, (unsigned long)fireCount[i], (unsigned long)expected);
+			++errors;
+		}
+	}
+
+	TimerWheel_cancel(&tw, &timers[1]);
+	assert(TimerWheel_nextExpiry(&tw) == TIMER_NEVER);
+
+	if( errors ) {
+		fprintf(stderr, "FAIL!!!\n");
+		return 1;
+	}
+	fprintf(stderr, "**** %u timers fired on time ****\n", TIMER_COUNT);
+	return 0;
+}
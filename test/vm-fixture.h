@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+** Copyright (c) 2017-2018 Wael El Oraiby.
+**
+**  This program is free software: you can redistribute it and/or modify
+**  it under the terms of the GNU Affero General Public License as
+**  published by the Free Software Foundation, either version 3 of the
+**  License, or (at your option) any later version.
+**
+**  This program is distributed in the hope that it will be useful,
+**  but WITHOUT ANY WARRANTY; without even the implied warranty of
+**  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**  GNU Affero General Public License for more details.
+**
+**  You should have received a copy of the GNU Affero General Public License
+**  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// a small VM with one worker and its first process, for the tests and benches
+// running words. test.probe keeps the last value it pops in probed, test.add
+// adds it to sum
+//
+
+#include "../src/internals.h"
+
+static uint32_t     probed  = 0;
+static uint32_t     sum     = 0;
+
+static inline
+void
+probe(Process* proc) {
+	probed  = vmPopValue(proc).u32;
+}
+
+static inline
+void
+add(Process* proc) {
+	sum += vmPopValue(proc).u32;
+}
+
+static inline
+VMParameters
+testParameters() {
+	return (VMParameters) {
+		.maxProcCount           = 16,
+		.maxFileCount           = 16,
+		.maxCFCount             = 16,
+		.maxCISCount            = 1024,
+		.workerCount            = 1,
+	};
+}
+
+static inline
+VM*
+newVMWith(const VMParameters* params, Process** proc) {
+	VM*     vm  = vmNew(params);
+	*proc   = vmNewProcess(vm, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, (ProcPtr){ .ptr = 0 }, 256, 256, 256, 4096, 64);
+	return vm;
+}
+
+/// a VM without any native of the test, see addProbes
+static inline
+VM*
+newVM(Process** proc) {
+	VMParameters    params  = testParameters();
+	return newVMWith(&params, proc);
+}
+
+static inline
+void
+addProbes(VM* vm) {
+	vmAddNativeFunction(vm, "test.probe", false, probe, 1, 0);
+	vmAddNativeFunction(vm, "test.add", false, add, 1, 0);
+}
+
+static inline
+void
+releaseVM(VM* vm, Process* proc) {
+	vm->quit    = true;
+	vmReleaseProcess(proc);
+	vmRelease(vm);
+}
+
+static inline
+void
+eval(Process* proc, const char* src) {
+	VM* vm  = proc->vm;
+	vmStreamPush(vm, vmStreamFromMemory(vm, src, (uint32_t)strlen(src)));
+	vmPushValue(proc, (Value){ .u32 = 0 });
+	vmReadEvalPrintLoop(proc);
+	vmStreamPop(vm);
+}